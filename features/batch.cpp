@@ -0,0 +1,268 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the Batch class */
+
+#include "batch.h"
+#include "features.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <stdexcept>
+#include <dirent.h>
+
+/* Constructor
+ *
+ * @specs the features to extract from each image, in the order they are written
+ * @threads the number of threads, or 0 to use one for each processor
+ */
+Batch::Batch ( const std::vector<FeatureSpec> & specs, int threads ) : pool ( threads ) {
+    for ( unsigned int i = 0; i < specs.size(); i++ ) {
+        Features::checkSpec ( specs[i] );
+    }
+    this->specs = specs;
+}
+
+/* Destructor */
+Batch::~Batch() {
+
+}
+
+/* Reads the features to extract from a configuration file
+ *
+ * @fname the path of the configuration file
+ */
+std::vector<FeatureSpec> Batch::readConfig ( std::string fname ) {
+
+    std::ifstream in ( fname.c_str() );
+    if ( !in ) {
+        throw std::runtime_error ( "Batch: could not open " + fname );
+    }
+
+    std::vector<FeatureSpec> specs;
+    std::string line;
+    while ( std::getline ( in, line ) ) {
+
+        /* Skip comments and blank lines */
+        size_t hash = line.find ( '#' );
+        if ( hash != std::string::npos ) {
+            line.erase ( hash );
+        }
+        std::istringstream words ( line );
+        FeatureSpec spec;
+        if ( !( words >> spec.name ) ) {
+            continue;
+        }
+
+        std::string word;
+        while ( words >> word ) {
+            std::istringstream number ( word );
+            double a;
+            if ( !( number >> a ) || !number.eof() ) {
+                throw std::runtime_error ( "Batch: bad argument " + word + " for " + spec.name );
+            }
+            spec.args.push_back ( a );
+        }
+
+        Features::checkSpec ( spec );
+        specs.push_back ( spec );
+
+    }
+
+    return specs;
+
+}
+
+/* Reads the paths of the images from a manifest. Blank lines are skipped
+ *
+ * @fname the path of the manifest
+ */
+std::vector<std::string> Batch::readManifest ( std::string fname ) {
+
+    std::ifstream in ( fname.c_str() );
+    if ( !in ) {
+        throw std::runtime_error ( "Batch: could not open " + fname );
+    }
+
+    std::vector<std::string> files;
+    std::string line;
+    while ( std::getline ( in, line ) ) {
+        if ( !line.empty() && line[line.size()-1] == '\r' ) {
+            line.erase ( line.size()-1 );
+        }
+        if ( !line.empty() ) {
+            files.push_back ( line );
+        }
+    }
+    return files;
+
+}
+
+/* Lists the images in a directory. Files are taken to be images by their extension, and are sorted by name so that
+ * the output does not depend on the order the file system lists them in
+ *
+ * @dir the path of the directory
+ */
+std::vector<std::string> Batch::readDirectory ( std::string dir ) {
+
+    DIR * d = opendir ( dir.c_str() );
+    if ( d == 0 ) {
+        throw std::runtime_error ( "Batch: could not open " + dir );
+    }
+
+    const char * extensions[] = { ".png", ".jpg", ".jpeg", ".tif", ".tiff", ".bmp", ".gif", ".pgm", ".pbm", ".ppm" };
+    std::vector<std::string> names;
+    struct dirent * entry;
+    while ( ( entry = readdir ( d ) ) != 0 ) {
+        std::string name = entry->d_name;
+        size_t dot = name.rfind ( '.' );
+        if ( dot == std::string::npos ) {
+            continue;
+        }
+        std::string ext = name.substr ( dot );
+        std::transform ( ext.begin(), ext.end(), ext.begin(), ::tolower );
+        for ( unsigned int i = 0; i < sizeof ( extensions ) /sizeof ( extensions[0] ); i++ ) {
+            if ( ext == extensions[i] ) {
+                names.push_back ( name );
+                break;
+            }
+        }
+    }
+    closedir ( d );
+
+    std::sort ( names.begin(), names.end() );
+    if ( !dir.empty() && dir[dir.size()-1] != '/' ) {
+        dir += '/';
+    }
+    for ( unsigned int i = 0; i < names.size(); i++ ) {
+        names[i] = dir + names[i];
+    }
+    return names;
+
+}
+
+/* Extracts the features of one image, one feature after the other in the order of the configuration
+ *
+ * @fname the path of the image
+ */
+std::vector<double> Batch::extract ( std::string fname ) {
+
+    Magick::Image image;
+    image.read ( fname );
+    Features features ( &image, fname );
+
+    /* The images are already spread over the pool, so each image is done on one thread */
+    std::vector<double> f = features.extract ( specs );
+    return f;
+
+}
+
+/* Extracts the features of every image on the pool and writes one line for each image to the output.
+ *
+ * Finished lines wait in a buffer until all of the lines before them have been written, so the output is in the
+ * same order as the images. Only a few images for each thread are started ahead of the next line to be written, so
+ * the buffer stays small even if one image is slow. Images which cannot be read or whose features fail are reported
+ * on stderr and left out.
+ *
+ * @files the paths of the images
+ * @out where to write the features
+ */
+int Batch::run ( const std::vector<std::string> & files, std::ostream & out ) {
+
+    long n = files.size();
+    long window = 4*pool.size();
+
+    /* Lines which are finished but not yet written, by the index of the image, and the errors of
+     * images which failed */
+    std::map<long, std::string> ready;
+    std::map<long, std::string> errors;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    long submitted = 0;
+    int failed = 0;
+    for ( long written = 0; written < n; written++ ) {
+
+        /* Keep the window of images in flight full */
+        while ( submitted < n && submitted < written+window ) {
+            long index = submitted++;
+            pool.submit ( [this, &files, &ready, &errors, &mutex, &finished, index] () {
+                std::ostringstream line;
+                std::string error;
+                bool ok = true;
+                try {
+                    std::vector<double> f = extract ( files[index] );
+                    line << std::setprecision ( std::numeric_limits<double>::digits10 ) << files[index];
+                    for ( unsigned int i = 0; i < f.size(); i++ ) {
+                        line << ' ' << f[i];
+                    }
+                    line << '\n';
+                } catch ( std::exception & e ) {
+                    error = e.what();
+                    ok = false;
+                } catch ( ... ) {
+                    error = "unknown error";
+                    ok = false;
+                }
+                std::lock_guard<std::mutex> lock ( mutex );
+                ready[index] = line.str();
+                if ( !ok ) {
+                    errors[index] = error;
+                }
+                finished.notify_all();
+            } );
+        }
+
+        /* Wait for the next line and write it */
+        std::string line;
+        std::string error;
+        bool bad;
+        {
+            std::unique_lock<std::mutex> lock ( mutex );
+            finished.wait ( lock, [&ready, written] () {
+                return ready.count ( written ) > 0;
+            } );
+            line.swap ( ready[written] );
+            ready.erase ( written );
+            bad = errors.count ( written ) > 0;
+            if ( bad ) {
+                error = errors[written];
+                errors.erase ( written );
+            }
+        }
+        if ( bad ) {
+            std::cerr << files[written] << ": " << error << std::endl;
+            failed++;
+        } else {
+            out << line;
+        }
+
+    }
+
+    pool.wait();
+    out.flush();
+    return failed;
+
+}
@@ -0,0 +1,76 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* This class extracts features from a whole corpus of word images.
+ *
+ * The features to extract are read from a configuration file with one feature on each line. Each line holds the name
+ * of the feature followed by its arguments, as for Features::extract, and lines starting with # are ignored:
+ *
+ *     hog g ch cw c si            or   hog g s ch cw c si
+ *     usbitmaps h w [h w ...]
+ *     dct bh bw s q
+ *     jpegdct s q
+ *     moments xybar m1 m2 m3 m4 bh bw o
+ *     martibunke                  or   martibunke w s
+ *     holistic
+ *     gabor sx sy nf f1 ... fnf nt theta1 ... thetant bh bw [fft]
+ *
+ * The images are shared out between the threads of a work-stealing pool. The FFTW plans and scratch buffers are kept
+ * for each thread by FFTWCache, so the threads do not plan or allocate once they are warmed up. The features of each
+ * image are written on one line, the path followed by the features, in the same order as the images were given
+ * no matter which thread finished first.
+ */
+
+#ifndef _batch_h_
+#define _batch_h_
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include "threadpool.h"
+#include "features.h"
+
+class Batch {
+public:
+
+    /* Constructor */
+    Batch ( const std::vector<FeatureSpec> & specs, int threads );
+    /* Destructor */
+    ~Batch ();
+
+    /* Reads the features to extract from a configuration file */
+    static std::vector<FeatureSpec> readConfig ( std::string fname );
+    /* Reads the paths of the images from a manifest with one path on each line */
+    static std::vector<std::string> readManifest ( std::string fname );
+    /* Lists the images in a directory, sorted by name */
+    static std::vector<std::string> readDirectory ( std::string dir );
+
+    /* Extracts the features of one image */
+    std::vector<double> extract ( std::string fname );
+    /* Extracts the features of every image and writes them in order. Returns the number of images that failed */
+    int run ( const std::vector<std::string> & files, std::ostream & out );
+
+private:
+
+    std::vector<FeatureSpec> specs;
+    ThreadPool pool;
+
+};
+
+#endif // _batch_h_
@@ -32,16 +32,26 @@
 
 /* This class is used to compute the DCT feature set. Performs transform, quantization and zig-zag ordering
  *
- * Makes use of the FFTW3 library in order to perform the DCT transform
+ * Makes use of the FFTW3 library in order to perform the DCT transform. The plans are kept in the FFTWCache
  */
 
 #include "dct.h"
 #include <iostream>
+#include <string.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <stdexcept>
+#include <jpeglib.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined ( __SSE2__ )
+#include <emmintrin.h>
+#endif
 
 /* Constructor */
-DCT::DCT ( Magick::Image * i ) {
-    image = new Magick::Image();
-    image = i;
+DCT::DCT ( GrayView v ) {
+    image = v;
+    pool = 0;
 }
 
 /* Destrcutor */
@@ -49,7 +59,101 @@ DCT::~DCT() {
 
 }
 
+/* The number of blocks which are gathered and transformed together */
+static const int BATCH = 64;
+
+/* Sets a pool to split the batches of blocks between. Each batch writes the features of its blocks to their own
+ * place in the feature vector, so the features are the same as when the work is done on one thread.
+ *
+ * @p the pool, or 0 to do all of the work on the calling thread
+ */
+void DCT::setPool ( ThreadPool * p ) {
+    pool = p;
+}
+
+/* Gets the DCT-II basis for blocks of size N, laid out so that basis[x*N+v] is the weight of sample x in
+ * coefficient v. The weights include the factor of 2 that FFTW's unnormalised REDFT10 uses.
+ */
+template <int N> static const double * getBasis() {
+    static double basis[N*N];
+    static bool ready = ( [] () {
+        for ( int x = 0; x < N; x++ ) {
+            for ( int v = 0; v < N; v++ ) {
+                basis[x*N+v] = 2*cos ( M_PI*v* ( 2*x+1 ) / ( 2.0*N ) );
+            }
+        }
+        return true;
+    } ) ();
+    ( void ) ready;
+    return basis;
+}
+
+/* Adds w times the first n values of row to sum, four values at a time. n is a multiple of 4 */
+static inline void addScaled ( double * sum, const double * row, double w, int n ) {
+#ifdef __AVX2__
+    __m256d wv = _mm256_set1_pd ( w );
+    for ( int v = 0; v < n; v+=4 ) {
+        _mm256_storeu_pd ( sum+v, _mm256_add_pd ( _mm256_loadu_pd ( sum+v ), _mm256_mul_pd ( wv, _mm256_loadu_pd ( row+v ) ) ) );
+    }
+#elif defined ( __SSE2__ )
+    __m128d wv = _mm_set1_pd ( w );
+    for ( int v = 0; v < n; v+=2 ) {
+        _mm_storeu_pd ( sum+v, _mm_add_pd ( _mm_loadu_pd ( sum+v ), _mm_mul_pd ( wv, _mm_loadu_pd ( row+v ) ) ) );
+    }
+#else
+    for ( int v = 0; v < n; v++ ) {
+        sum[v] += w*row[v];
+    }
+#endif
+}
+
+/* Computes the 2D DCT-II of an N*N block as two matrix products, giving the same values as FFTW's REDFT10 in
+ * both dimensions. Only the top left rows*columns coefficients are computed and the rest are set to zero, since
+ * the first coefficients in the zig-zag order all lie near the top left corner.
+ *
+ * @in the block
+ * @out the coefficients
+ * @rows the number of rows of coefficients needed
+ * @columns the number of columns of coefficients needed
+ */
+template <int N> static void transformBlock ( const double * in, double * out, int rows, int columns ) {
+
+    const double * basis = getBasis<N>();
+
+    /* Round the columns up to whole vectors. The extra columns are real coefficients, so they do no harm */
+    int n = ( columns+3 ) & ~3;
+    if ( n > N ) {
+        n = N;
+    }
+
+    /* Transform along each row, keeping only the first n coefficients */
+    double rowPass[N*N];
+    memset ( rowPass, 0, sizeof ( rowPass ) );
+    for ( int y = 0; y < N; y++ ) {
+        for ( int x = 0; x < N; x++ ) {
+            addScaled ( rowPass+y*N, basis+x*N, in[y*N+x], n );
+        }
+    }
+
+    /* Transform down each column for the first rows coefficients */
+    memset ( out, 0, N*N*sizeof ( double ) );
+    for ( int u = 0; u < rows; u++ ) {
+        for ( int y = 0; y < N; y++ ) {
+            addScaled ( out+u*N, rowPass+y*N, basis[y*N+u], n );
+        }
+    }
+
+}
+
+/* The zig-zag orders, by block height and width */
+std::map< std::pair<int,int>, std::vector<int> > DCT::zigzags;
+std::mutex DCT::zigzagsMutex;
+
 /* Computes the DCT coefficients.
+ * The blocks are processed in batches. Each batch is gathered into one array, transformed with a single
+ * batched FFTW plan, and then quantized and ordered in passes over the whole batch. If a pool has been set, the
+ * batches are shared out between its threads.
+ *
  * @b the block size
  * @s the number of output coefficients
  * @q quantize the coefficients
@@ -59,104 +163,322 @@ std::vector<double> DCT::getDCT(int bh, int bw, int s, bool q) {
     /* The feature vector */
     std::vector<double> f;
 
-    /* Initialize the plan and set the block size */
-    fftw_plan p;
+    /* Set the block size */
     int block_width = bw;
     int block_height = bh;
+    int block_size = block_height*block_width;
 
-    /* Initialise the input and output arrays and create the plan */
-    in = ( double* ) fftw_malloc ( block_height*block_width * sizeof ( double ) );
-    out = ( double* ) fftw_malloc ( block_height*block_width * sizeof ( double ) );
-    p = fftw_plan_r2r_2d ( block_height, block_width, in, out, FFTW_REDFT10, FFTW_REDFT10, FFTW_MEASURE );
+    /* The blocks, in the order the features are output */
+    int block_rows = ( image.rows() + block_height-1 ) /block_height;
+    int block_columns = ( image.columns() + block_width-1 ) /block_width;
+    int blocks = block_rows*block_columns;
 
-    /* Loop through the blocks */
-    for ( unsigned int i = 0; i < image->rows(); i+=block_height ) {
-        for ( unsigned int j = 0; j < image->columns(); j+=block_width ) {
+    /* Each block gives s coefficients, which cannot be more than the block holds */
+    if ( s > block_size ) {
+        throw std::out_of_range ( "DCT: more coefficients were asked for than a block holds" );
+    }
+    f.resize ( ( size_t ) blocks*s );
+    if ( blocks == 0 || s <= 0 ) {
+        return f;
+    }
+
+    /* 8x8 and 16x16 blocks are transformed with fixed size kernels, which only compute the coefficients that are
+     * output. The zig-zag order reaches diagonal d after (d+1)(d+2)/2 coefficients, so only the coefficients
+     * on the first diagonals are needed. Normalising by the largest coefficient needs the whole block, so
+     * that case still goes through FFTW
+     */
+    bool fixed = ( block_height == block_width ) && ( block_width == 8 || block_width == 16 ) && !( q == true && block_width > 8 && s > 8 );
+    int needed = 0;
+    while ( ( needed* ( needed+1 ) ) /2 < s && needed < block_width ) {
+        needed++;
+    }
 
-            /* Create the input array for the current block */
-            int y = 0;
-            for ( unsigned  int k = i; k < i+block_height; k++ ) {
+    /* Get the plan from the cache. The plan is only measured the first time this block size is used in the
+     * process, and can be run by any thread on its own arrays
+     */
+    fftw_plan p = fixed ? 0 : FFTWCache::getPlan ( FFTWCache::DCT2, block_height, block_width, BATCH, FFTW_MEASURE );
+
+    /* Loop through the batches of blocks. Each thread gets its own input and output arrays from the cache */
+    int batches = ( blocks+BATCH-1 ) /BATCH;
+    ThreadPool::parallelFor ( pool, 0, batches, [&] ( int begin, int end ) {
+        double * in = FFTWCache::getBuffer ( 0, ( size_t ) BATCH*block_size );
+        double * out = FFTWCache::getBuffer ( 1, ( size_t ) BATCH*block_size );
+        for ( int batch = begin; batch < end; batch++ ) {
+            int first = batch*BATCH;
+            int count = blocks-first < BATCH ? blocks-first : BATCH;
+            transformBatch ( first, count, block_height, block_width, s, q, fixed, needed, p, in, out, &f[0] );
+        }
+    } );
+
+    /* Return the fearure vector */
+    return f;
+
+}
+
+/* Transforms one batch of blocks and writes the features of each block to its place in the feature vector.
+ *
+ * @first the index of the first block in the batch
+ * @count the number of blocks in the batch
+ * @block_height the block height
+ * @block_width the block width
+ * @s the number of output coefficients
+ * @q quantize the coefficients
+ * @fixed transform with the fixed size kernels rather than the plan
+ * @needed the number of rows and columns of coefficients the fixed size kernels compute
+ * @p the batched plan
+ * @in the input array, which holds a batch of blocks
+ * @out the output array, which holds a batch of blocks
+ * @f the feature vector
+ */
+void DCT::transformBatch(int first, int count, int block_height, int block_width, int s, bool q, bool fixed, int needed, fftw_plan p, double * in, double * out, double * f) {
+
+    int block_size = block_height*block_width;
+    int block_columns = ( image.columns() + block_width-1 ) /block_width;
+    const std::vector<int> & order = getZigzag ( block_height, block_width );
+
+    /* Create the input array for each block in the batch.
+     * Blocks which run past the edge of the image are padded with the edge pixels
+     */
+    for ( int b = 0; b < count; b++ ) {
+        int i = ( ( first+b ) /block_columns ) *block_height;
+        int j = ( ( first+b ) %block_columns ) *block_width;
+        double * block = in + ( size_t ) b*block_size;
+        int y = 0;
+        for ( int k = i; k < i+block_height; k++ ) {
+            if ( j+block_width <= image.columns() && k < image.rows() ) {
+                const float * row = image.row ( k ) + j;
+                for ( int x = 0; x < block_width; x++ ) {
+                    block[y*block_width+x] = row[x];
+                }
+            } else {
                 int x = 0;
-                for ( unsigned int l = j; l < j+block_width; l++ ) {
-                    in[y*block_width+x] = Magick::ColorGray ( image->pixelColor ( l,k ) ).shade();
+                for ( int l = j; l < j+block_width; l++ ) {
+                    block[y*block_width+x] = image.pixel ( l,k );
                     x++;
                 }
-                y++;
             }
+            y++;
+        }
+    }
 
-            /* Execute the plan to perform the DCT-II for the current block */
-            fftw_execute ( p );
+    /* The rest of the last batch is not used, but is cleared so that it is not transformed from garbage */
+    for ( size_t l = ( size_t ) count*block_size; l < ( size_t ) BATCH*block_size; l++ ) {
+        in[l] = 0;
+    }
+
+    /* Perform the DCT-II for every block in the batch */
+    if ( fixed == false ) {
+        fftw_execute_r2r ( p, in, out );
+    } else if ( block_width == 8 ) {
+        for ( int b = 0; b < count; b++ ) {
+            transformBlock<8> ( in + ( size_t ) b*block_size, out + ( size_t ) b*block_size, needed, needed );
+        }
+    } else {
+        for ( int b = 0; b < count; b++ ) {
+            transformBlock<16> ( in + ( size_t ) b*block_size, out + ( size_t ) b*block_size, needed, needed );
+        }
+    }
+
+    /* Quantize the block coefficients if necessary */
+    if (q == true) {
+        quantize(out, count, block_height, block_width, s);
+    }
+
+    /* Copy the first s coefficients of each block in the zig-zag order straight into the feature vector */
+    for ( int b = 0; b < count; b++ ) {
+        const double * block = out + ( size_t ) b*block_size;
+        double * features = f + ( size_t ) ( first+b ) *s;
+        for (int z = 0; z < s; z++) {
+            features[z] = block[order[z]];
+        }
+    }
+
+}
+
+/* Reports libjpeg errors by jumping back to the caller instead of exiting */
+struct JPEGError {
+    struct jpeg_error_mgr manager;
+    jmp_buf jump;
+};
+
+static void jpegErrorExit ( j_common_ptr cinfo ) {
+    JPEGError * error = ( JPEGError * ) cinfo->err;
+    longjmp ( error->jump, 1 );
+}
+
+/* Computes the DCT coefficients of 8x8 blocks straight from the coefficients stored in a baseline or progressive
+ * JPEG file, without decoding the pixels. This gives the same features as getDCT(8, 8, s, q) on the decoded
+ * image, up to the rounding of the stored coefficients.
+ *
+ * Only the first component is used. For greyscale files this is the image itself, but for colour files it is the
+ * luminance, while getDCT works on the green channel that ColorGray::shade() gives.
+ *
+ * A stored coefficient F is the dequantised DCT of the samples less 128, scaled by C(u)C(v)/4 where
+ * C(0) = 1/sqrt(2) and C(k) = 1 otherwise. getDCT transforms samples in [0;1] with FFTW's unnormalised DCT, which
+ * scales by 4, so its coefficients are 4/255 * (4F/(C(u)C(v))), with 128*64 added back to the DC coefficient.
+ * libjpeg pads the last blocks with the edge pixels, as getDCT does.
+ *
+ * @fname the path of the JPEG file
+ * @s the number of output coefficients
+ * @q quantize the coefficients
+ */
+std::vector<double> DCT::getJPEGDCT(std::string fname, int s, bool q) {
+
+    /* The feature vector */
+    std::vector<double> f;
+
+    if ( s > 64 ) {
+        throw std::out_of_range ( "DCT: more coefficients were asked for than a block holds" );
+    }
+
+    FILE * file = fopen ( fname.c_str(), "rb" );
+    if ( file == 0 ) {
+        throw std::runtime_error ( "DCT: could not open " + fname );
+    }
+
+    /* Cleared first, so that it can be destroyed even if libjpeg fails before it is created */
+    struct jpeg_decompress_struct cinfo;
+    memset ( &cinfo, 0, sizeof ( cinfo ) );
+    JPEGError error;
+    cinfo.err = jpeg_std_error ( &error.manager );
+    error.manager.error_exit = jpegErrorExit;
+
+    bool read = readJPEGDCT ( cinfo, error, file, s, q, f );
+    jpeg_destroy_decompress ( &cinfo );
+    fclose ( file );
+    if ( !read ) {
+        throw std::runtime_error ( "DCT: could not read the coefficients of " + fname );
+    }
+
+    /* Return the feature vector */
+    return f;
+
+}
+
+/* Reads the coefficients for getJPEGDCT. libjpeg reports errors by jumping back to the setjmp here, so everything
+ * which is needed after an error, the file, the decompressor and the feature vector, belongs to the caller and none
+ * of the locals here are used once it has jumped.
+ *
+ * @cinfo the decompressor, with its error manager set up
+ * @error the error manager that jumps back here
+ * @file the open JPEG file
+ * @s the number of output coefficients
+ * @q quantize the coefficients
+ * @f the feature vector to fill
+ */
+bool DCT::readJPEGDCT(struct jpeg_decompress_struct & cinfo, JPEGError & error, FILE * file, int s, bool q,
+        std::vector<double> & f) {
+
+    if ( setjmp ( error.jump ) ) {
+        return false;
+    }
+
+    jpeg_create_decompress ( &cinfo );
+    jpeg_stdio_src ( &cinfo, file );
+    jpeg_read_header ( &cinfo, TRUE );
+    jvirt_barray_ptr * coefficients = jpeg_read_coefficients ( &cinfo );
+
+    /* The blocks of the first component which cover the image */
+    jpeg_component_info * component = &cinfo.comp_info[0];
+    int block_rows = ( component->downsampled_height + 7 ) /8;
+    int block_columns = ( component->downsampled_width + 7 ) /8;
+    int blocks = block_rows*block_columns;
+
+    /* The factor which takes each stored coefficient to the coefficient getDCT gives, including dequantisation */
+    double scale[64];
+    for ( int u = 0; u < 8; u++ ) {
+        for ( int v = 0; v < 8; v++ ) {
+            double c = ( u == 0 ? M_SQRT1_2 : 1.0 ) * ( v == 0 ? M_SQRT1_2 : 1.0 );
+            scale[u*8+v] = ( 4.0/255.0 ) * ( 4.0/c ) * component->quant_table->quantval[u*8+v];
+        }
+    }
+    double dc = ( 4.0/255.0 ) * 128*64;
+
+    const std::vector<int> & order = getZigzag ( 8, 8 );
+    f.resize ( ( size_t ) blocks*s );
+    double * batch = FFTWCache::getBuffer ( 1, ( size_t ) BATCH*64 );
+
+    /* Go through the block rows in batches, as getDCT does */
+    int first = 0;
+    for ( int i = 0; i < block_rows; i++ ) {
+
+        JBLOCKARRAY row = ( cinfo.mem->access_virt_barray ) ( ( j_common_ptr ) &cinfo, coefficients[0], i, 1, FALSE );
+
+        for ( int j = 0; j < block_columns; ) {
+
+            int count = block_columns-j < BATCH ? block_columns-j : BATCH;
+
+            /* Convert the coefficients of each block in the batch */
+            for ( int b = 0; b < count; b++ ) {
+                const JCOEF * stored = row[0][j+b];
+                double * block = batch + ( size_t ) b*64;
+                for ( int l = 0; l < 64; l++ ) {
+                    block[l] = stored[l]*scale[l];
+                }
+                block[0] += dc;
+            }
 
             /* Quantize the block coefficients if necessary */
             if (q == true) {
-                quantize(bw, s);
+                quantize(batch, count, 8, 8, s);
             }
 
-            /* Extract the block coefficients in a zig-zag order */
-            std::vector<double> zz = zigzag(block_height, block_width, s);
-
-            double max = 1;
-            /* Normalise based on size */
-            for (unsigned int z = 1; z < zz.size(); z++) {
-                if (( abs(zz.at(z))) > max) {
-                    max = abs(zz.at(z));
+            /* Copy the first s coefficients of each block in the zig-zag order into the feature vector */
+            for ( int b = 0; b < count; b++ ) {
+                const double * block = batch + ( size_t ) b*64;
+                double * features = &f[( size_t ) ( first+b ) *s];
+                for (int z = 0; z < s; z++) {
+                    features[z] = block[order[z]];
                 }
             }
 
-            /* Add the block coeeficients to the feature matrix.
-            * Coefficients are rounded off to the nearest integer.
-            * Ignore the first coefficient
-            */
-            for (int z = 0; z < s; z++) {
-                f.push_back( zz.at(z));
-            }
+            first += count;
+            j += count;
 
         }
     }
 
-    /* Destroy the plan and free the arrays */
-    fftw_destroy_plan ( p );
-    fftw_free ( out );
-    fftw_free ( in );
-
-    /* Return the fearure vector */
-    return f;
+    jpeg_finish_decompress ( &cinfo );
+    return true;
 
 }
 
-/* Quantizes the feature vector using a popular quantization matrix (taken from Wikipedia)
+/* Quantizes the coefficients of a batch of blocks in the output array using a popular quantization matrix (taken
+ * from Wikipedia)
  * In the case where the block is greater than 8 and more than 8 coefficients are wanted, no quantization is performed
  *
- * @b the block size
+ * @out the coefficients of the batch
+ * @n the number of blocks in the batch
+ * @bh the block height
+ * @bw the block width
  * @s the size of the output coefficient vector
  */
 
-void DCT::quantize(int b, int s) {
+void DCT::quantize(double * out, int n, int bh, int bw, int s) {
+
+    int b = bw;
+    int size = bh*bw;
 
     /* If block size is greater than 8 and more than 8 coefficients are wanted then do not perform quantization since quantization uses an 8x8 matrix
      * Instead, just normalise with respect to the largest value excluding the DC value
      */
     if ((b > 8) && (s > 8)) {
 
-        /* Find the maximum coefficient for the block (excluding DC) */
-        double max = 0;
-        for (int k = 0; k < b; k++ ) {
-            for (int l = 0; l < b; l++ ) {
-                if ((k==0) && (l==0)) {
+        for (int m = 0; m < n; m++) {
 
-                }
-                else {
-                    if (out[k*b+l] > max) {
-                        max = out[k*b+l];
-                    }
+            double * block = out + ( size_t ) m*size;
+
+            /* Find the maximum coefficient for the block (excluding DC) */
+            double max = 0;
+            for (int l = 1; l < size; l++ ) {
+                if (block[l] > max) {
+                    max = block[l];
                 }
             }
-        }
 
-        /* Divide all coefficients by the maximum */
-        for (int k = 0; k < b; k++ ) {
-            for (int l = 0; l < b; l++ ) {
-                out[k*b+l] = out[k*b+l]/max;
+            /* Divide all coefficients by the maximum */
+            for (int l = 0; l < size; l++ ) {
+                block[l] = block[l]/max;
             }
 
         }
@@ -234,80 +556,55 @@ void DCT::quantize(int b, int s) {
         q[7][6] = 103;
         q[7][7] = 99;
 
-        /* Perform quantization */
-        for (int k = 0; k < b; k++ ) {
-            for (int l = 0; l < b; l++) {
-                out[k*b+l] = out[k*b+l]/q[k][l];
+        /* Lay the matrix out like a block. Coefficients outside of the 8x8 matrix are left as they are */
+        std::vector<double> divisors ( size, 1.0 );
+        for (int k = 0; k < bh && k < 8; k++ ) {
+            for (int l = 0; l < bw && l < 8; l++) {
+                divisors[k*bw+l] = q[k][l];
+            }
+        }
+
+        /* Perform quantization on every block in the batch */
+        const double * d = &divisors[0];
+        for (int m = 0; m < n; m++) {
+            double * block = out + ( size_t ) m*size;
+            for (int l = 0; l < size; l++) {
+                block[l] = block[l]/d[l];
             }
         }
 
     }
 }
 
-/* Reorders the coefficients in a zig-zag order.
- * Code taken from http://refactormycode.com/codes/451-zig-zag-ordering-of-array - LICENSE unclear so will rewrite
+/* Gets the zig-zag order of the coefficients of a bh*bw block, as the index of each coefficient in the block.
+ * The anti-diagonals are walked in turn, going up and to the right on even diagonals and down and to the left on
+ * odd ones. For square blocks this is the usual JPEG order. The tables are cached, so each one is only built once.
+ *
+ * @bh the block height
+ * @bw the block width
  */
-std::vector<double> DCT::zigzag(int bh, int bw, int s) {
-
-    /* Vector for storing zigzag coefficients */
-    std::vector<double> zigzag;
-
-    /* Temporary arrays */
-    double temp[bh*bw];
-    double temp2[bh*bw];
-
-    /* Convert 2D input array to 1D array */
-    int p = 0;
-    for (int i = 0; i < bh; i++) {
-        for (int j =  0; j < bw; j++) {
-            temp[p] = out[i*bw+j];
-            p++;
-        }
-    }
-
-    /* The maximym dimensions are the block size */
-    int xmax = bh;
-    int ymax = bw;
-
-    int x = 1;
-    int y = 1;
-
-    /* Loop through the array */
-    for (int t = 0; t < (bh*bw); t++) {
-        /* Set the value for the temporary vector */
-        temp2[t] = temp[(y-1)*xmax+(x-1)];
-        /* Even zigzag stripes */
-        if ((x + y) % 2 == 0) {
-
-            if (x < xmax) {
-                x++;
-            } else {
-                y+= 2;
-            }
-            if (y > 1) {
-                y--;
-            }
-        }
-        /* Odd zigzag stripes */
-        else {
-            if (y < ymax) {
-                y++;
+const std::vector<int> & DCT::getZigzag(int bh, int bw) {
+
+    std::lock_guard<std::mutex> lock ( zigzagsMutex );
+
+    std::vector<int> & order = zigzags[std::make_pair ( bh, bw )];
+    if ( order.empty() ) {
+        order.reserve ( bh*bw );
+        for ( int d = 0; d < bh+bw-1; d++ ) {
+            int first = d-bw+1 > 0 ? d-bw+1 : 0;
+            int last = d < bh-1 ? d : bh-1;
+            if ( d%2 == 0 ) {
+                for ( int row = last; row >= first; row-- ) {
+                    order.push_back ( row*bw + d-row );
+                }
             } else {
-                x+= 2;
-            }
-            if (x > 1) {
-                x--;
+                for ( int row = first; row <= last; row++ ) {
+                    order.push_back ( row*bw + d-row );
+                }
             }
         }
-
-    }
-
-    /* Add the zigzag coefficients to the vector based on the requested output size */
-    for (int i = 0; i < s; i++) {
-        zigzag.push_back(temp2[i]);
     }
 
-    /* Return the zigzag array */
-    return zigzag;
+    return order;
 
 }
@@ -39,31 +39,52 @@
 #ifndef _dct_h_
 #define _dct_h_
 
-#include <Magick++.h>
 #include <math.h>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <string>
+#include <stdio.h>
 #include <fftw3.h>
+#include "fftwcache.h"
+#include "grayimage.h"
+#include "threadpool.h"
+
+struct jpeg_decompress_struct;
+struct JPEGError;
 
 class DCT {
 public:
 
     /* Constructor */
-    DCT ( Magick::Image * i );
+    DCT ( GrayView v );
     /* Destructor */
     ~DCT ();
 
     /* Calculates the DCT coefficients for use as features */
     std::vector<double> getDCT(int bh, int bw, int s, bool q);
+    /* Calculates the DCT coefficients from the coefficients stored in a JPEG file */
+    std::vector<double> getJPEGDCT(std::string fname, int s, bool q);
+    /* Sets a pool to split the batches of blocks between. The work is done on the calling thread by default */
+    void setPool ( ThreadPool * p );
 
 private:
 
-    double *in;
-    double *out;
-    Magick::Image * image;
-    /* Quantizes the coefficients */
-    void quantize(int b, int s);
-    /* Gets the zig-zag order of the coefficients */
-    std::vector<double> zigzag(int bh, int bw, int s);
+    GrayView image;
+    ThreadPool * pool;
+    /* Transforms one batch of blocks and writes its features */
+    void transformBatch(int first, int count, int bh, int bw, int s, bool q, bool fixed, int needed, fftw_plan p, double * in, double * out, double * f);
+    /* Reads the coefficients of an open JPEG file into the feature vector, returning false if libjpeg failed */
+    bool readJPEGDCT(struct jpeg_decompress_struct & cinfo, JPEGError & error, FILE * file, int s, bool q,
+            std::vector<double> & f);
+    /* Quantizes the coefficients of a batch of blocks */
+    void quantize(double * out, int n, int bh, int bw, int s);
+    /* Gets the zig-zag order of the coefficients of a block */
+    static const std::vector<int> & getZigzag(int bh, int bw);
+
+    /* The cached zig-zag orders */
+    static std::map< std::pair<int,int>, std::vector<int> > zigzags;
+    static std::mutex zigzagsMutex;
 
 };
 
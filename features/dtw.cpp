@@ -0,0 +1,355 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the DTW class */
+
+#include "dtw.h"
+#include <algorithm>
+#include <limits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined ( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+/* The number of words in the smallest piece that the database is split into */
+static const int CHUNK = 256;
+
+static const double INFINITE = std::numeric_limits<double>::infinity();
+
+/* Orders the nearest words so that the worst one is at the front of the heap */
+static bool nearer ( const std::pair<double,int> & a, const std::pair<double,int> & b ) {
+    return a < b;
+}
+
+/* Adds (a - b[j])^2 to sum[j] for the n values from j = 0 */
+static inline void addSquares ( double * sum, const double * b, double a, int n ) {
+    int j = 0;
+#ifdef __AVX2__
+    __m256d av = _mm256_set1_pd ( a );
+    for ( ; j+4 <= n; j+=4 ) {
+        __m256d d = _mm256_sub_pd ( av, _mm256_loadu_pd ( b+j ) );
+        _mm256_storeu_pd ( sum+j, _mm256_add_pd ( _mm256_loadu_pd ( sum+j ), _mm256_mul_pd ( d, d ) ) );
+    }
+#elif defined ( __SSE2__ )
+    __m128d av = _mm_set1_pd ( a );
+    for ( ; j+2 <= n; j+=2 ) {
+        __m128d d = _mm_sub_pd ( av, _mm_loadu_pd ( b+j ) );
+        _mm_storeu_pd ( sum+j, _mm_add_pd ( _mm_loadu_pd ( sum+j ), _mm_mul_pd ( d, d ) ) );
+    }
+#endif
+    for ( ; j < n; j++ ) {
+        double d = a-b[j];
+        sum[j] += d*d;
+    }
+}
+
+/* Constructor
+ *
+ * @length the length that the profiles of every word are resampled to
+ * @band the number of columns either side of the diagonal that a warping path may stray, the Sakoe-Chiba band
+ */
+DTW::DTW ( int length, int band ) {
+    this->length = length > 0 ? length : 1;
+    this->band = band > 0 ? band : 0;
+    count = 0;
+    pool = 0;
+}
+
+/* Destructor */
+DTW::~DTW() {
+
+}
+
+/* Sets a pool to split the database between. Each piece of the database keeps its own nearest words, which are
+ * merged in order, so the words found are the same as when the work is done on one thread.
+ *
+ * @p the pool, or 0 to do all of the work on the calling thread
+ */
+void DTW::setPool ( ThreadPool * p ) {
+    pool = p;
+}
+
+/* Adds a word to the database
+ *
+ * @holistic the holistic features of the word, from Features::getHolistic
+ * @rows the height of the word image
+ */
+int DTW::addWord ( const std::vector<int> & holistic, int rows ) {
+    words.resize ( ( size_t ) ( count+1 ) *PROFILES*length );
+    prepare ( holistic, rows, &words[( size_t ) count*PROFILES*length] );
+    return count++;
+}
+
+/* The number of words in the database */
+int DTW::size() const {
+    return count;
+}
+
+/* Resamples the profiles of a word to the common length by linear interpolation between columns, and divides all but
+ * the transitions by the height of the word.
+ *
+ * @holistic the holistic features, interleaved by column
+ * @rows the height of the word image
+ * @profile where the PROFILES profiles are written, one after the other
+ */
+void DTW::prepare ( const std::vector<int> & holistic, int rows, double * profile ) const {
+
+    int columns = holistic.size() /PROFILES;
+    double height = rows > 0 ? rows : 1;
+
+    for ( int k = 0; k < PROFILES; k++ ) {
+        double scale = k < PROFILES-1 ? 1.0/height : 1.0;
+        for ( int t = 0; t < length; t++ ) {
+            double value = 0;
+            if ( columns == 1 || ( columns > 1 && length == 1 ) ) {
+                value = holistic[k];
+            } else if ( columns > 1 ) {
+                double x = t* ( double ) ( columns-1 ) / ( length-1 );
+                int c = ( int ) x;
+                if ( c >= columns-1 ) {
+                    c = columns-2;
+                }
+                double w = x-c;
+                value = ( 1-w ) *holistic[c*PROFILES+k] + w*holistic[( c+1 ) *PROFILES+k];
+            }
+            profile[k*length+t] = value*scale;
+        }
+    }
+
+}
+
+/* Gets the envelope of a profile, the largest and smallest value of each profile within the band around each point
+ *
+ * @profile the profiles of the word
+ * @upper where the upper envelope is written
+ * @lower where the lower envelope is written
+ */
+void DTW::getEnvelope ( const double * profile, double * upper, double * lower ) const {
+    for ( int k = 0; k < PROFILES; k++ ) {
+        const double * p = profile + k*length;
+        for ( int i = 0; i < length; i++ ) {
+            int first = i-band > 0 ? i-band : 0;
+            int last = i+band < length-1 ? i+band : length-1;
+            double u = p[first];
+            double l = p[first];
+            for ( int j = first+1; j <= last; j++ ) {
+                u = p[j] > u ? p[j] : u;
+                l = p[j] < l ? p[j] : l;
+            }
+            upper[k*length+i] = u;
+            lower[k*length+i] = l;
+        }
+    }
+}
+
+/* The LB_Kim lower bound. Every warping path matches the first columns and the last columns of the two words */
+double DTW::getLBKim ( const double * a, const double * b ) const {
+    double first = 0;
+    double last = 0;
+    for ( int k = 0; k < PROFILES; k++ ) {
+        double d = a[k*length]-b[k*length];
+        first += d*d;
+        d = a[k*length+length-1]-b[k*length+length-1];
+        last += d*d;
+    }
+    return length > 1 ? first+last : first;
+}
+
+/* The LB_Keogh lower bound. Every column of b is matched to some column of the query within the band, so it costs at
+ * least its distance outside of the envelope of the query. The sum is abandoned once it is more than best
+ *
+ * @upper the upper envelope of the query
+ * @lower the lower envelope of the query
+ * @b the profiles of the word
+ * @best the distance to beat
+ */
+double DTW::getLBKeogh ( const double * upper, const double * lower, const double * b, double best ) const {
+    double lb = 0;
+    for ( int i = 0; i < length; i++ ) {
+        for ( int k = 0; k < PROFILES; k++ ) {
+            double v = b[k*length+i];
+            double u = upper[k*length+i];
+            double l = lower[k*length+i];
+            if ( v > u ) {
+                lb += ( v-u ) * ( v-u );
+            } else if ( v < l ) {
+                lb += ( l-v ) * ( l-v );
+            }
+        }
+        if ( lb > best ) {
+            return lb;
+        }
+    }
+    return lb;
+}
+
+/* Gets the DTW distance between two words. The cost matrix is filled a row at a time within the band. The costs of
+ * matching a column of a to each column of b in the band are found first, a profile at a time so that the loop
+ * runs along contiguous memory, and then the cheapest path to each cell is added on.
+ * If every cell in a row costs more than best, no path can beat it and the distance is abandoned.
+ *
+ * @a the profiles of the first word
+ * @b the profiles of the second word
+ * @best the distance to beat
+ * @rows space for three rows of the cost matrix
+ */
+double DTW::getDistance ( const double * a, const double * b, double best, double * rows ) const {
+
+    double * previous = rows;
+    double * current = rows+length;
+    double * cost = rows+2*length;
+
+    for ( int i = 0; i < length; i++ ) {
+
+        int first = i-band > 0 ? i-band : 0;
+        int last = i+band < length-1 ? i+band : length-1;
+        int n = last-first+1;
+
+        /* The cost of matching column i of a to each column of b in the band */
+        std::fill ( cost+first, cost+first+n, 0.0 );
+        for ( int k = 0; k < PROFILES; k++ ) {
+            addSquares ( cost+first, b+k*length+first, a[k*length+i], n );
+        }
+
+        /* Add the cheapest path to each cell */
+        double smallest = INFINITE;
+        for ( int j = first; j <= last; j++ ) {
+            double path;
+            if ( i == 0 ) {
+                path = j == 0 ? 0 : current[j-1];
+            } else {
+                path = ( j <= i-1+band ) ? previous[j] : INFINITE;
+                if ( j > first ) {
+                    path = std::min ( path, current[j-1] );
+                }
+                if ( j > 0 && j-1 >= i-1-band ) {
+                    path = std::min ( path, previous[j-1] );
+                }
+            }
+            current[j] = cost[j]+path;
+            smallest = std::min ( smallest, current[j] );
+        }
+
+        if ( smallest > best ) {
+            return INFINITE;
+        }
+
+        std::swap ( previous, current );
+
+    }
+
+    return previous[length-1];
+
+}
+
+/* Gets the distance between two words in the database
+ *
+ * @a the index of the first word
+ * @b the index of the second word
+ */
+double DTW::getDistance ( int a, int b ) {
+    std::vector<double> rows ( 3*length );
+    return getDistance ( getWord ( a ), getWord ( b ), INFINITE, &rows[0] );
+}
+
+/* Matches the query against some of the words, keeping the k nearest in a heap with the worst at the front.
+ * Each word is first compared by LB_Kim, then by LB_Keogh, and only then by DTW, each against the k-th best
+ * distance so far.
+ *
+ * @query the profiles of the query
+ * @upper the upper envelope of the query
+ * @lower the lower envelope of the query
+ * @k the number of words to keep
+ * @first the first word to match
+ * @last one past the last word to match
+ * @nearest the heap of the nearest words
+ */
+void DTW::search ( const double * query, const double * upper, const double * lower, int k, int first, int last, std::vector< std::pair<double,int> > & nearest ) const {
+
+    std::vector<double> rows ( 3*length );
+
+    for ( int i = first; i < last; i++ ) {
+
+        const double * word = getWord ( i );
+        double best = ( int ) nearest.size() < k ? INFINITE : nearest.front().first;
+
+        if ( getLBKim ( query, word ) > best ) {
+            continue;
+        }
+        if ( getLBKeogh ( upper, lower, word, best ) > best ) {
+            continue;
+        }
+        double d = getDistance ( query, word, best, &rows[0] );
+        if ( d > best || ( d == best && ( int ) nearest.size() == k ) ) {
+            continue;
+        }
+
+        nearest.push_back ( std::make_pair ( d, i ) );
+        std::push_heap ( nearest.begin(), nearest.end(), nearer );
+        if ( ( int ) nearest.size() > k ) {
+            std::pop_heap ( nearest.begin(), nearest.end(), nearer );
+            nearest.pop_back();
+        }
+
+    }
+
+}
+
+/* Finds the k words in the database which are nearest to a query.
+ * The database is shared out between the threads of the pool in runs of chunks. Each run keeps its own k nearest
+ * words, which are merged at the end.
+ *
+ * @holistic the holistic features of the query, from Features::getHolistic
+ * @rows the height of the query image
+ * @k the number of words to find
+ */
+std::vector< std::pair<double,int> > DTW::getNearest ( const std::vector<int> & holistic, int rows, int k ) {
+
+    std::vector< std::pair<double,int> > nearest;
+    if ( k <= 0 || count == 0 ) {
+        return nearest;
+    }
+
+    /* Prepare the query and its envelope */
+    std::vector<double> query ( PROFILES*length );
+    std::vector<double> upper ( PROFILES*length );
+    std::vector<double> lower ( PROFILES*length );
+    prepare ( holistic, rows, &query[0] );
+    getEnvelope ( &query[0], &upper[0], &lower[0] );
+
+    /* Each run of chunks keeps its nearest words by the index of its first chunk */
+    int chunks = ( count+CHUNK-1 ) /CHUNK;
+    std::vector< std::vector< std::pair<double,int> > > found ( chunks );
+    ThreadPool::parallelFor ( pool, 0, chunks, [&] ( int begin, int end ) {
+        search ( &query[0], &upper[0], &lower[0], k, begin*CHUNK, std::min ( count, end*CHUNK ), found[begin] );
+    } );
+
+    /* Merge the nearest words of each run */
+    for ( int c = 0; c < chunks; c++ ) {
+        nearest.insert ( nearest.end(), found[c].begin(), found[c].end() );
+    }
+    std::sort ( nearest.begin(), nearest.end() );
+    if ( ( int ) nearest.size() > k ) {
+        nearest.resize ( k );
+    }
+
+    return nearest;
+
+}
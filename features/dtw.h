@@ -0,0 +1,101 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Features based on:
+ * T.M. Rath and R. Manmatha, “Word Image Matching Using Dynamic Time Warping,” Proceedings of the 2003 IEEE Computer
+ * Society Conference on Computer Vision and Pattern Recognition (CVPR'03), IEEE Computer Society, 2003, pp. 521-527.
+ *
+ * E. Keogh and C. A. Ratanamahatana, “Exact indexing of dynamic time warping,” Knowledge and Information Systems,
+ * 7(3):358–386, 2005.
+ */
+
+/* This class matches word images by dynamic time warping (DTW) of their holistic features.
+ *
+ * Each word is described by the six profiles that Features::getHolistic gives for each column. The profiles are
+ * divided by the height of the word so that words of different sizes can be compared, and resampled to a common
+ * length. The distance between two words is the cost of the cheapest warping path between their profiles within a
+ * Sakoe-Chiba band, where the cost of matching two columns is the squared distance between their six values.
+ *
+ * A query is matched against a database of words to find the k nearest. Most words are ruled out cheaply by the
+ * LB_Kim and then LB_Keogh lower bounds, and the DTW of the rest is abandoned as soon as it cannot beat the k-th
+ * best word found so far. The database can be split between the threads of a pool.
+ */
+
+#ifndef _dtw_h_
+#define _dtw_h_
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include "threadpool.h"
+
+class DTW {
+public:
+
+    /* Constructor */
+    DTW ( int length, int band );
+    /* Destructor */
+    ~DTW ();
+
+    /* Adds a word to the database from its holistic features. Returns the index of the word */
+    int addWord ( const std::vector<int> & holistic, int rows );
+    /* The number of words in the database */
+    int size() const;
+
+    /* Gets the distance between two words in the database */
+    double getDistance ( int a, int b );
+    /* Finds the k words in the database which are nearest to the query, as (distance, index) pairs */
+    std::vector< std::pair<double,int> > getNearest ( const std::vector<int> & holistic, int rows, int k );
+    /* Sets a pool to split the database between. The work is done on the calling thread by default */
+    void setPool ( ThreadPool * p );
+
+    /* The number of profiles for each column */
+    static const int PROFILES = 6;
+
+private:
+
+    /* The length that the profiles are resampled to, and the width of the band either side of the diagonal */
+    int length;
+    int band;
+
+    /* The words, each stored as PROFILES profiles of length values one after the other */
+    std::vector<double> words;
+    int count;
+    ThreadPool * pool;
+
+    /* Resamples and normalises the holistic features of a word */
+    void prepare ( const std::vector<int> & holistic, int rows, double * profile ) const;
+    /* Gets the envelope of a profile within the band, for LB_Keogh */
+    void getEnvelope ( const double * profile, double * upper, double * lower ) const;
+    /* The lower bounds */
+    double getLBKim ( const double * a, const double * b ) const;
+    double getLBKeogh ( const double * upper, const double * lower, const double * b, double best ) const;
+    /* The distance between two profiles, abandoned once it is more than best */
+    double getDistance ( const double * a, const double * b, double best, double * rows ) const;
+    /* Matches the query against the words in [first, last) */
+    void search ( const double * query, const double * upper, const double * lower, int k, int first, int last, std::vector< std::pair<double,int> > & nearest ) const;
+
+    /* Gets the start of a word's profiles */
+    const double * getWord ( int i ) const {
+        return &words[( size_t ) i*PROFILES*length];
+    }
+
+};
+
+#endif // _dtw_h_
@@ -0,0 +1,78 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Extracts features from a corpus of word images.
+ *
+ * Usage: extract [-t threads] config images
+ *
+ * config is the feature configuration (see batch.h) and images is either a directory of images or a manifest with
+ * the path of one image on each line. The features of each image are written to stdout on one line, starting with
+ * the path of the image, in the same order as the images were listed. By default one thread is used per processor.
+ */
+
+#include "batch.h"
+#include <Magick++.h>
+#include <iostream>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/stat.h>
+
+int main ( int argc, char ** argv ) {
+
+    Magick::InitializeMagick ( *argv );
+
+    int threads = 0;
+    int arg = 1;
+    if ( arg+1 < argc && std::string ( argv[arg] ) == "-t" ) {
+        threads = atoi ( argv[arg+1] );
+        arg += 2;
+    }
+    if ( argc-arg != 2 ) {
+        std::cerr << "Usage: " << argv[0] << " [-t threads] config images" << std::endl;
+        return 1;
+    }
+
+    try {
+
+        std::vector<FeatureSpec> specs = Batch::readConfig ( argv[arg] );
+
+        /* The images are either a directory or a manifest */
+        std::vector<std::string> files;
+        struct stat s;
+        if ( stat ( argv[arg+1], &s ) == 0 && S_ISDIR ( s.st_mode ) ) {
+            files = Batch::readDirectory ( argv[arg+1] );
+        } else {
+            files = Batch::readManifest ( argv[arg+1] );
+        }
+
+        Batch batch ( specs, threads );
+        int failed = batch.run ( files, std::cout );
+        if ( failed > 0 ) {
+            std::cerr << failed << " of " << files.size() << " images failed" << std::endl;
+            return 2;
+        }
+
+    } catch ( std::exception & e ) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+
+}
@@ -25,9 +25,15 @@
  */
 
 #include "features.h"
+#include <algorithm>
+#include <stdexcept>
+
+/* The number of rows of the image that the moment tables are built for at a time, when cells overlap */
+static const int MOMENT_BAND = 128;
 
 /* Constructor
- * Makes a new image based on the pointer so as to not modify the original image.
+ * Keeps the pointer to the image, which is not modified or copied. The caller keeps ownership of it.
+ * The greyscale pixels that the feature classes work on are decoded from it once here.
  *
  * @i pointer to image for which features should be extracted
  * @fname the path of the image for which features should be extracted - this used for cases where external programs extract
@@ -35,9 +41,10 @@
  */
 
 Features::Features ( Magick::Image * i, std::string fname ) {
-    image = new Magick::Image();
     image = i;
+    gray = GrayImage ( i );
     filename = fname;
+    pool = 0;
 }
 
 /* Constructor
@@ -47,48 +54,48 @@ Features::Features ( Magick::Image * i, std::string fname ) {
  */
 
 Features::Features (std::string fname ) {
+    image = 0;
     filename = fname;
+    pool = 0;
+}
+
+/* Default constructor */
+Features::Features() {
+    image = 0;
+    pool = 0;
 }
 
-/* Destructor deletes the pointer - should only be done at the end of the program */
+/* Destructor. The image belongs to the caller so it is not deleted */
 Features::~Features() {
 }
 
+/* Sets a pool to split the work on this image between. HoG, DCT, Gabor and the moments split their cells or
+ * blocks between the threads of the pool and write each one to its place in the feature vector, so the features
+ * are the same as without the pool. This is meant for single large images, such as whole pages, when there are no
+ * other images to keep the threads busy. The pool is not owned, and must outlive its use here.
+ *
+ * @p the pool, or 0 to do all of the work on the calling thread
+ */
+void Features::setPool ( ThreadPool * p ) {
+    pool = p;
+}
+
 /* Returns the holistic features set.
  * I don't think this will make it into the final project
  */
 
 std::vector<int> Features::getHolistic() {
 
-    std::vector<int> f; //Create a vector to hold the features
+    /* The feature classes only read from the shared greyscale image, so no copy is needed */
+    Holistic holistic ( gray.view() );
 
-    /* Because more than one set of features might be extracted from the image
-     * a copy is made to prevent any changes affecting other features
+    /* Gets the holistic features in one pass over the image. For each column these are the projection profile of
+     * the whole height, the top half and the bottom half, the upper and lower profiles and the transitions.
+     * See the holistic.cpp for details
      */
+    std::vector<int> f = holistic.getHolistic();
 
-    Magick::Image * copy = new Magick::Image ( *image );
-    Holistic holistic ( copy );
-
-    /* Gets the holistic features. See the holistic.cpp for details */
-    std::vector<int> pp = holistic.getProjectionProfile ( 0, image->rows() ); //Whole height of image
-    std::vector<int> upp = holistic.getProjectionProfile ( 0, image->rows() /2 ); // Top half
-    std::vector<int> lpp = holistic.getProjectionProfile ( image->rows() /2, image->rows() ); //Bottom half
-    std::vector<int> up = holistic.getProfile ( false ); //Upper profile
-    std::vector<int> lp = holistic.getProfile ( true ); //Lower profile
-    std::vector<int> t = holistic.getTransitions();
-
-    /* Adds the features to the vector */
-    for ( unsigned int i = 0; i < pp.size(); i++ ) {
-        f.push_back ( pp.at ( i ) );
-        f.push_back ( upp.at ( i ) );
-        f.push_back ( lpp.at ( i ) );
-        f.push_back ( up.at ( i ) );
-        f.push_back ( lp.at ( i ) );
-        f.push_back ( t.at ( i ) );
-    }
-
-    /* Delete the copy image and return the vector */
-    delete copy;
+    /* Return the vector */
     return f;
 
 }
@@ -102,36 +109,62 @@ std::vector<int> Features::getHolistic() {
  */
 std::vector<double> Features::getHoG ( int g, int ch, int cw, int c, bool si ) {
 
-    /* Create the copy image to prevent changes to original image */
-    Magick::Image * copy = new Magick::Image ( *image );
-    HoG hog ( copy );
-    /* Get the features */
+    HoG hog ( gray.view() );
+    hog.setPool ( pool );
+    /* Get the features and return the feature vector */
     std::vector<double> f = hog.getHistogram ( g,ch,cw,c,si );
-    /* Delete the copy and return the feature vector */
-    delete copy;
+    return f;
+
+}
+
+/* Returns the Histogram of Oriented Gradients (HoG) feature set with overlapping block normalisation.
+ * @g the block size for normalisation, in cells
+ * @s the block stride, in cells
+ * @ch the cell height
+ * @cw the cell width
+ * @c - number of histogram channels
+ * @si - if the histograms are signed or not
+ */
+std::vector<double> Features::getHoG ( int g, int s, int ch, int cw, int c, bool si ) {
+
+    HoG hog ( gray.view() );
+    hog.setPool ( pool );
+    /* Get the features and return the feature vector */
+    std::vector<double> f = hog.getHistogram ( g,s,ch,cw,c,si );
     return f;
 
 }
 
 /* Gets the undersampled bitmaps feature set.
- * @r - the number of regions to divide each dimension into
+ * @h - the number of regions down the image
+ * @w - the number of regions across the image
  */
 std::vector<double> Features::getUSBitmaps ( int h, int w ) {
 
-    /* Create the copy */
-    Magick::Image * copy = new Magick::Image ( *image );
-    USBitmaps usb ( copy );
-    /* Get the feature vector */
+    USBitmaps usb ( gray.view() );
+    /* Get the feature vector and return it */
+    std::vector<double> f = usb.getUSBitmaps ( h, w );
+    return f;
+
+}
+
+/* Gets the undersampled bitmaps feature set for several grid sizes, one after the other.
+ * @h - the number of regions down the image for each grid
+ * @w - the number of regions across the image for each grid
+ */
+std::vector<double> Features::getUSBitmaps ( std::vector<int> h, std::vector<int> w ) {
+
+    USBitmaps usb ( gray.view() );
+    /* Get the feature vector and return it */
     std::vector<double> f = usb.getUSBitmaps ( h, w );
-    /* Delete the copy and return the feature vector */
-    delete copy;
     return f;
 
 }
 
 /* Calculates the Gabor filter features.
  *
- * @fname the path to the file which is parsed to the Octave program
+ * @fname the path to the image. The filters now run on the shared greyscale image, so it is no longer used and
+ * is left unnamed
  * @sx variance along x-axis (shape of Gaussian)
  * @sy variance along y-axis (shape of Gaussian)
  * @f vector of frequencies
@@ -139,20 +172,42 @@ std::vector<double> Features::getUSBitmaps ( int h, int w ) {
  * @bh block height
  * @bw block width
  */
-std::vector<double> Features::getGabor(std::string fname, double sx, double sy, std::vector<double> f, std::vector<double> theta, int bh, int bw) {
-
-    /* Copy image is needed on disk so that the Octave function can find the image */
-    Magick::Image * copy = new Magick::Image ( *image );
-    copy->write("gabor.png");
+std::vector<double> Features::getGabor(std::string, double sx, double sy, std::vector<double> f, std::vector<double> theta, int bh, int bw) {
 
     /* Create the Gabor object */
-    Gabor gabor ("gabor.png");
+    Gabor gabor ( gray.view() );
+    gabor.setPool ( pool );
 
-    /* Get the feature vector */
+    /* Get the feature vector and return it */
     std::vector<double> feat = gabor.getGabor(sx, sy, f, theta, bh, bw);
+    return feat;
+
+}
+
+/* Calculates the Gabor filter features, applying the filters in the frequency domain if wanted.
+ * The frequency domain is much faster for large images and filter banks.
+ *
+ * @fname the path to the image. The filters now run on the shared greyscale image, so it is no longer used and
+ * is left unnamed
+ * @sx variance along x-axis (shape of Gaussian)
+ * @sy variance along y-axis (shape of Gaussian)
+ * @f vector of frequencies
+ * @theta vector of orientations
+ * @bh block height
+ * @bw block width
+ * @fft apply the filters in the frequency domain
+ */
+std::vector<double> Features::getGabor(std::string, double sx, double sy, std::vector<double> f, std::vector<double> theta, int bh, int bw, bool fft) {
 
-    /* Return the feature vector and delete the copy */
-    delete copy;
+    /* Create the Gabor object */
+    Gabor gabor ( gray.view() );
+    gabor.setPool ( pool );
+    if ( fft == true ) {
+        gabor.setMode ( Gabor::FREQUENCY );
+    }
+
+    /* Get the feature vector and return it */
+    std::vector<double> feat = gabor.getGabor(sx, sy, f, theta, bh, bw);
     return feat;
 
 }
@@ -165,13 +220,24 @@ std::vector<double> Features::getGabor(std::string fname, double sx, double sy,
  */
 std::vector<double> Features::getDCT(int bh, int bw, int s, bool q) {
 
-    /* Create the copy */
-    Magick::Image * copy = new Magick::Image ( *image );
-    DCT dct ( copy );
-    /* Get the DCT feature set */
+    DCT dct ( gray.view() );
+    dct.setPool ( pool );
+    /* Get the DCT feature set and return it */
     std::vector<double> f = dct.getDCT(bh, bw, s, q);
-    /* Delete the copy and return the feature set */
-    delete copy;
+    return f;
+
+}
+
+/* Gets the DCT feature set for 8x8 blocks from the coefficients stored in the JPEG file given by the filename,
+ * without decoding the image. See DCT::getJPEGDCT for how this compares to getDCT(8, 8, s, q).
+ * @s the number of coefficients to be output
+ * @q quantize the coefficients
+ */
+std::vector<double> Features::getJPEGDCT(int s, bool q) {
+
+    DCT dct ( gray.view() );
+    /* Get the DCT feature set and return it */
+    std::vector<double> f = dct.getJPEGDCT(filename, s, q);
     return f;
 
 }
@@ -188,91 +254,383 @@ std::vector<double> Features::getDCT(int bh, int bw, int s, bool q) {
  * */
 std::vector<double> Features::getMoments ( bool xybar, bool m1, bool m2, bool m3, bool m4, int bh, int bw, int o ) {
 
+    /* Going to loop through the cells in the image based on the cell size and overlap.
+     * Every cell gives the same number of features, so each column of cells knows where its features go
+     */
+    int columns = 0;
+    for ( int i = 0; i < gray.columns()-o; i+=bw-o ) {
+        columns++;
+    }
+    int rows = 0;
+    for ( int j = 0; j < gray.rows()-o; j+=bh-o ) {
+        rows++;
+    }
+    int size = ( xybar ? 2 : 0 ) + ( m1 ? 1 : 0 ) + ( m2 ? 1 : 0 ) + ( m3 ? 1 : 0 ) + ( m4 ? 1 : 0 );
+
     /* Create the feature vector */
-    std::vector<double> f;
+    std::vector<double> f ( ( size_t ) columns*rows*size );
 
-    /* Going to loop through the cells in the image based on the cell size and overlap.
-     * Image is separated into sub-images here and features are extracted for each sub0image
+    /* Cells which do not overlap cover each pixel once at most, so one pass over each cell is no slower than building
+     * tables and needs no memory
      */
-    for ( unsigned int i = 0; i < image->columns()-o; i+=bw-o ) {
-        for ( unsigned int j = 0; j < image->rows()-o; j+=bh-o ) {
+    if ( o <= 0 ) {
+        getMomentCells ( 0, 0, 0, rows, columns, rows, xybar, m1, m2, m3, m4, bh, bw, o, f );
+        return f;
+    }
+
+    /* Overlapping cells are looked up in summed area tables. The tables take ten doubles for every pixel, so they are
+     * built for a band of rows of cells at a time rather than for the whole image
+     */
+    int band = std::max ( 1, MOMENT_BAND/ ( bh-o ) );
+    for ( int first = 0; first < rows; first += band ) {
+        int last = std::min ( rows, first+band );
+        int top = first* ( bh-o );
+        int bottom = std::min ( gray.rows(), ( last-1 ) * ( bh-o ) + bh );
+        MomentTable table ( gray.view().region ( 0, top, gray.columns(), bottom-top ) );
+        getMomentCells ( &table, top, first, last, columns, rows, xybar, m1, m2, m3, m4, bh, bw, o, f );
+    }
+
+    /* Return the feature vector */
+    return f;
+
+}
+
+/* Gets the statistical moments features of some rows of cells, either from summed area tables which cover the cells or
+ * with a pass over each cell. See getMoments above for the other arguments
+ *
+ * @table the summed area tables of the band of the image which holds the cells, or 0 to make a pass over each cell
+ * @top the first row of the image that the tables cover
+ * @first the first row of cells
+ * @last one past the last row of cells
+ * @columns the number of columns of cells
+ * @rows the number of rows of cells
+ * @f the feature vector, with the features of each cell in its place
+ */
+void Features::getMomentCells ( const MomentTable * table, int top, int first, int last, int columns, int rows, bool xybar,
+                                bool m1, bool m2, bool m3, bool m4, int bh, int bw, int o, std::vector<double> & f ) {
+
+    int size = ( xybar ? 2 : 0 ) + ( m1 ? 1 : 0 ) + ( m2 ? 1 : 0 ) + ( m3 ? 1 : 0 ) + ( m4 ? 1 : 0 );
+
+    ThreadPool::parallelFor ( pool, 0, columns, [&] ( int begin, int end ) {
+        for ( int c = begin; c < end; c++ ) {
+
+            double * features = f.data() + ( ( size_t ) c*rows+first ) *size;
+            for ( int r = first; r < last; r++ ) {
+
+                /* The individual cell */
+                int offset_x = c* ( bw-o );
+                int offset_y = r* ( bh-o );
+
+                /* Create the Moments object for extrating features */
+                Moments m = table != 0 ? Moments ( *table, offset_x, offset_y-top, bw, bh )
+                            : Moments ( gray.view().region ( offset_x, offset_y, bw, bh ) );
+
+                /* Add x-bar and y-bar if wanted */
+                if ( xybar == true ) {
+                    *features++ = m.getXBar();
+                    *features++ = m.getYBar();
+                }
+
+                /* If the first moment was wanted */
+                if ( m1==true ) {
+                    *features++ = m.getHu ( 1 );
+                }
 
-            Magick::Image * copy = new Magick::Image ( *image );
+                /* If the second moment was wanted */
+                if ( m2==true ) {
+                    *features++ = m.getHu ( 2 );
+                }
 
-            /* Crop whole image into individual cell */
-            int offset_x = i;
-            int offset_y = j;
-            copy->page ( Magick::Geometry ( bw,bh,0,0 ) );
-            copy->crop ( Magick::Geometry ( bw,bh,offset_x,offset_y ) );
+                /* If the third moment was wanted */
+                if ( m3==true ) {
+                    *features++ = m.getHu ( 3 );
+                }
 
-            /* Create the Moments object for extrating features */
-            Moments m ( copy );
-            double mo;
+                /* If the fourth moment was wanted */
+                if ( m4==true ) {
+                    *features++ = m.getHu ( 4 );
+                }
 
-            /* Add x-bar and y-bar if wanted */
-            if ( xybar == true ) {
-                f.push_back ( m.getXBar() );
-                f.push_back ( m.getYBar() );
             }
-            
-            double ncm20 = m.getNCM(2,0);
-            double ncm02 = m.getNCM(0,2);
-            double ncm11 = m.getNCM(1,1);
-            double ncm30 = m.getNCM(3,0);
-            double ncm12 = m.getNCM(1,2);
-            double ncm21 = m.getNCM(2,1);
-            double ncm03 = m.getNCM(0,3);
-            
-            
-
-            /* If the first moment was wanted */
-            if ( m1==true ) {
-                mo = ncm20 + ncm02;
-                f.push_back ( mo );
+
+        }
+    } );
+
+}
+
+/* Gets the Marti & Bunke feature set */
+std::vector< double > Features::getMartiBunke() {
+
+    MartiBunke mb ( gray.view() );
+
+    /* Get the features and return the feature vector */
+    std::vector<double> f = mb.getMartiBunke();
+    return f;
+
+}
+
+/* Gets the Marti & Bunke feature set with a sliding window
+ * @w the width of the window
+ * @s the shift of the window between frames
+ */
+std::vector< double > Features::getMartiBunke ( int w, int s ) {
+
+    MartiBunke mb ( gray.view() );
+
+    /* Get the features and return the feature vector */
+    std::vector<double> f = mb.getMartiBunke ( w, s );
+    return f;
+
+}
+
+/* Checks that a feature has been given a number of arguments it accepts */
+static void checkArgs ( const FeatureSpec & spec, bool valid ) {
+    if ( !valid ) {
+        throw std::runtime_error ( "Features: wrong number of arguments for " + spec.name );
+    }
+}
+
+/* Checks that a feature is known and has been given a number of arguments it accepts, throwing if it has not.
+ * The counts of the Gabor frequencies and orientations are among the arguments, so they are followed to find where
+ * the block size starts
+ *
+ * @spec the feature
+ */
+void Features::checkSpec ( const FeatureSpec & spec ) {
+
+    int n = spec.args.size();
+    if ( spec.name == "hog" ) {
+        checkArgs ( spec, n == 5 || n == 6 );
+    } else if ( spec.name == "usbitmaps" ) {
+        checkArgs ( spec, n > 0 && n%2 == 0 );
+    } else if ( spec.name == "dct" ) {
+        checkArgs ( spec, n == 4 );
+    } else if ( spec.name == "jpegdct" ) {
+        checkArgs ( spec, n == 2 );
+    } else if ( spec.name == "moments" ) {
+        checkArgs ( spec, n == 8 );
+    } else if ( spec.name == "martibunke" ) {
+        checkArgs ( spec, n == 0 || n == 2 );
+    } else if ( spec.name == "holistic" ) {
+        checkArgs ( spec, n == 0 );
+    } else if ( spec.name == "gabor" ) {
+        checkArgs ( spec, n >= 3 );
+        int nf = spec.args[2];
+        checkArgs ( spec, nf >= 0 && n >= 4+nf );
+        int nt = spec.args[3+nf];
+        checkArgs ( spec, nt >= 0 && ( n == 6+nf+nt || n == 7+nf+nt ) );
+    } else {
+        throw std::runtime_error ( "Features: unknown feature " + spec.name );
+    }
+
+}
+
+/* Extracts several features of the image at once, and returns them one after the other in the order of the
+ * configuration. Each feature is named by its family, and its arguments are those of the matching method:
+ *
+ *     hog g ch cw c si            or   hog g s ch cw c si
+ *     usbitmaps h w [h w ...]
+ *     dct bh bw s q
+ *     jpegdct s q
+ *     moments xybar m1 m2 m3 m4 bh bw o
+ *     martibunke                  or   martibunke w s
+ *     holistic
+ *     gabor sx sy nf f1 ... fnf nt theta1 ... thetant bh bw [fft]
+ *
+ * Separate getX calls each redo the work they have in common. Here that work is done once and shared:
+ *
+ *     grey image -> thresholded image -> gradients (hog), foreground counts (usbitmaps)
+ *                -> transposed image  -> column runs -> martibunke, holistic
+ *                -> image spectrum    -> gabor
+ *
+ * The thresholded and transposed images are made first, and then each family is run with them. The transposed
+ * image is also thresholded and run-length encoded down each column, so for a binary image martibunke and holistic
+ * take their contours, transitions and weights from the runs. The features of one family are done in turn on one
+ * object, so the counts and spectrum are built once for all of them. If a pool has been set, the
+ * intermediates and then the families run on it at the same time, and each family still splits its own work as set
+ * out in setPool. The features are the same either way.
+ *
+ * @config the features to extract
+ */
+std::vector<double> Features::extract ( const std::vector<FeatureSpec> & config ) {
+
+    /* Find the families, in the order they first appear, and the intermediates they need */
+    std::vector<std::string> families;
+    bool needBinary = false;
+    bool needTransposed = false;
+    for ( unsigned int i = 0; i < config.size(); i++ ) {
+        checkSpec ( config[i] );
+        const std::string & name = config[i].name;
+        if ( std::find ( families.begin(), families.end(), name ) == families.end() ) {
+            families.push_back ( name );
+        }
+        if ( name == "hog" || name == "usbitmaps" ) {
+            needBinary = true;
+        }
+        if ( name == "martibunke" || name == "holistic" ) {
+            needTransposed = true;
+        }
+    }
+
+    /* Make the intermediates */
+    BinaryImage binary;
+    GrayImage transposed;
+    ColumnRuns runs;
+    ThreadPool::parallelFor ( pool, 0, 2, [&] ( int begin, int end ) {
+        for ( int i = begin; i < end; i++ ) {
+            if ( i == 0 && needBinary == true ) {
+                binary = BinaryImage ( gray.view() );
+            }
+            if ( i == 1 && needTransposed == true ) {
+                transposed = GrayImage::transpose ( gray.view() );
+                runs = ColumnRuns ( BinaryImage ( transposed.view() ) );
             }
+        }
+    } );
+
+    /* Run the families. Each writes the features of its own entries in the configuration */
+    std::vector< std::vector<double> > results ( config.size() );
+    ThreadPool::parallelFor ( pool, 0, families.size(), [&] ( int begin, int end ) {
+        for ( int i = begin; i < end; i++ ) {
+            extractFamily ( families[i], config, needBinary ? &binary : 0, transposed.view(), needTransposed ? &runs : 0,
+                            results );
+        }
+    } );
 
-            /* If the second moment was wanted */
-            if ( m2==true ) {
-                mo = pow ( ( ncm20-ncm02),2 ) + 4* ( pow ( ncm11,2 ) );
-                f.push_back ( mo );
+    /* Put the features together in the order of the configuration */
+    std::vector<double> f;
+    for ( unsigned int i = 0; i < results.size(); i++ ) {
+        f.insert ( f.end(), results[i].begin(), results[i].end() );
+    }
+    return f;
+
+}
+
+/* Extracts every feature of one family in the configuration. One object of the family is used for all of them, so
+ * whatever it builds from the image is built once
+ *
+ * @family the name of the family
+ * @config the features to extract
+ * @binary the thresholded image, if the family needs it
+ * @transposed the transposed image, if the family needs it
+ * @runs the runs of foreground in each column, if the family needs them
+ * @results the features of each entry in the configuration
+ */
+void Features::extractFamily ( const std::string & family, const std::vector<FeatureSpec> & config, const BinaryImage * binary,
+                               GrayView transposed, const ColumnRuns * runs, std::vector< std::vector<double> > & results ) {
+
+    if ( family == "hog" ) {
+
+        /* The image is only thresholded once for every cell size, number of channels and sign */
+        HoG hog ( gray.view() );
+        hog.setPool ( pool );
+        hog.setBinary ( binary );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
             }
+            if ( a.size() == 5 ) {
+                results[i] = hog.getHistogram ( a[0], a[1], a[2], a[3], a[4] != 0 );
+            } else {
+                results[i] = hog.getHistogram ( a[0], a[1], a[2], a[3], a[4], a[5] != 0 );
+            }
+        }
 
-            /* If the third moment was wanted */
-            if ( m3==true ) {
-                mo = pow ( ( ncm30- ( 3* ( ncm12 ) ) ),2 ) + pow ( ( ( 3* ( ncm21 ) )-ncm03 ),2 );
-                f.push_back ( mo );
+    } else if ( family == "usbitmaps" ) {
+
+        /* The foreground counts are built once for every grid */
+        USBitmaps usb ( gray.view() );
+        usb.setBinary ( binary );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
+            }
+            std::vector<int> h, w;
+            for ( unsigned int j = 0; j < a.size(); j += 2 ) {
+                h.push_back ( a[j] );
+                w.push_back ( a[j+1] );
             }
+            results[i] = usb.getUSBitmaps ( h, w );
+        }
+
+    } else if ( family == "dct" || family == "jpegdct" ) {
 
-            /* If the fourth moment was wanted */
-            if ( m4==true ) {
-                mo = pow ( ( ncm30 +ncm12 ),2 ) + pow ( ( ncm21-ncm03 ),2 );
-                f.push_back ( mo );
+        DCT dct ( gray.view() );
+        dct.setPool ( pool );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
             }
+            if ( family == "dct" ) {
+                results[i] = dct.getDCT ( a[0], a[1], a[2], a[3] != 0 );
+            } else {
+                results[i] = dct.getJPEGDCT ( filename, a[0], a[1] != 0 );
+            }
+        }
 
-            /* Delete the cell image */
-            delete copy;
+    } else if ( family == "moments" ) {
 
+        /* Each cell size builds its own tables a band at a time, as tables of the whole image would be too large */
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
+            }
+            results[i] = getMoments ( a[0] != 0, a[1] != 0, a[2] != 0, a[3] != 0, a[4] != 0, a[5], a[6], a[7] );
         }
 
-    }
+    } else if ( family == "martibunke" ) {
 
-    /* Return the feature vector */
-    return f;
+        MartiBunke mb ( gray.view() );
+        mb.setTransposed ( transposed );
+        mb.setRuns ( runs );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
+            }
+            if ( a.empty() ) {
+                results[i] = mb.getMartiBunke();
+            } else {
+                results[i] = mb.getMartiBunke ( a[0], a[1] );
+            }
+        }
 
-}
+    } else if ( family == "holistic" ) {
 
-/* Gets the Marti & Bunke feature set */
-std::vector< double > Features::getMartiBunke() {
+        Holistic holistic ( gray.view() );
+        holistic.setTransposed ( transposed );
+        holistic.setRuns ( runs );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            if ( config[i].name != family ) {
+                continue;
+            }
+            std::vector<int> h = holistic.getHolistic();
+            results[i].assign ( h.begin(), h.end() );
+        }
 
-    /* Create a copy so as not to write over the original */
-    Magick::Image * copy = new Magick::Image ( *image );
-    MartiBunke mb ( copy );
+    } else if ( family == "gabor" ) {
 
-    /* Get the features */
-    std::vector<double> f = mb.getMartiBunke();
+        /* The spectrum of the image is only taken once for all of the filters in the frequency domain */
+        Gabor gabor ( gray.view() );
+        gabor.setPool ( pool );
+        for ( unsigned int i = 0; i < config.size(); i++ ) {
+            const std::vector<double> & a = config[i].args;
+            if ( config[i].name != family ) {
+                continue;
+            }
+            int nf = a[2];
+            int nt = a[3+nf];
+            std::vector<double> freq ( a.begin()+3, a.begin()+3+nf );
+            std::vector<double> theta ( a.begin()+4+nf, a.begin()+4+nf+nt );
+            bool fft = a.size() == ( unsigned int ) ( 7+nf+nt ) && a[6+nf+nt] != 0;
+            gabor.setMode ( fft ? Gabor::FREQUENCY : Gabor::SPATIAL );
+            results[i] = gabor.getGabor ( a[0], a[1], freq, theta, a[4+nf+nt], a[5+nf+nt] );
+        }
 
-    /* Delete the copy and return the feature vector */
-    delete copy;
-    return f;
+    }
 
 }
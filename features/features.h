@@ -27,7 +27,9 @@
 
 #include <Magick++.h>
 #include <vector>
+#include <string>
 #include <math.h>
+#include "grayimage.h"
 #include "moments.h"
 #include "hog.h"
 #include "usbitmaps.h"
@@ -35,6 +37,15 @@
 #include "dct.h"
 #include "martibunke.h"
 #include "gabor.h"
+#include "threadpool.h"
+
+/* A feature to extract, as the name of the feature and its arguments in the same order as the matching method
+ * of the Features class. See Features::extract for the names
+ */
+struct FeatureSpec {
+    std::string name;
+    std::vector<double> args;
+};
 
 class Features {
 
@@ -49,17 +60,41 @@ public:
     /* Methods to get all features and return a vector for each feature */
     std::vector<double> getMoments ( bool xybar, bool m1, bool m2, bool m3, bool m4, int bh, int bw, int o );
     std::vector<double> getHoG ( int g, int ch, int cw, int c, bool si );
+    std::vector<double> getHoG ( int g, int s, int ch, int cw, int c, bool si );
     std::vector<double> getUSBitmaps ( int h, int w );
+    std::vector<double> getUSBitmaps ( std::vector<int> h, std::vector<int> w );
     std::vector<int> getHolistic();
     std::vector<double> getGabor(std::string fname, double sx, double sy, std::vector<double> f, std::vector<double> theta, int bh, int bw);
+    std::vector<double> getGabor(std::string fname, double sx, double sy, std::vector<double> f, std::vector<double> theta, int bh, int bw, bool fft);
     std::vector<double> getDCT(int bh, int bw, int s, bool q);
+    std::vector<double> getJPEGDCT(int s, bool q);
     std::vector<double> getMartiBunke();
+    std::vector<double> getMartiBunke ( int w, int s );
+
+    /* Sets a pool to split the work on this image between, for large images. The work is done on the calling
+     * thread by default
+     */
+    void setPool ( ThreadPool * p );
 
+    /* Extracts several features at once, sharing the work they have in common, and returns them one after the other */
+    std::vector<double> extract ( const std::vector<FeatureSpec> & config );
+    /* Checks that a feature is known and has been given a number of arguments it accepts */
+    static void checkSpec ( const FeatureSpec & spec );
 
 private:
 
     Magick::Image * image;
+    /* Greyscale copy of the image which is decoded once and shared by all of the feature classes */
+    GrayImage gray;
     std::string filename;
+    ThreadPool * pool;
+
+    /* Gets the moments of some rows of cells, from tables of the band of the image that holds them or one cell at a time */
+    void getMomentCells ( const MomentTable * table, int top, int first, int last, int columns, int rows, bool xybar,
+                          bool m1, bool m2, bool m3, bool m4, int bh, int bw, int o, std::vector<double> & f );
+    /* Extracts every feature of one family in the configuration, using the intermediates that have been shared */
+    void extractFamily ( const std::string & family, const std::vector<FeatureSpec> & config, const BinaryImage * binary,
+                         GrayView transposed, const ColumnRuns * runs, std::vector< std::vector<double> > & results );
 
 };
 
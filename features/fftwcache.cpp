@@ -0,0 +1,171 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the FFTWCache class */
+
+#include "fftwcache.h"
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+/* The plans, keyed by kind, rows, columns, batch size and flags */
+typedef std::tuple<int, int, int, int, unsigned> PlanKey;
+static std::map<PlanKey, fftw_plan> plans;
+
+/* Guards the plans and every call into the FFTW planner */
+static std::mutex plannerMutex;
+
+/* The scratch buffers of one thread. They are freed when the thread exits */
+struct ThreadBuffers {
+    double * data[FFTWCache::SLOTS];
+    size_t size[FFTWCache::SLOTS];
+    ThreadBuffers() {
+        for ( int i = 0; i < FFTWCache::SLOTS; i++ ) {
+            data[i] = 0;
+            size[i] = 0;
+        }
+    }
+    ~ThreadBuffers() {
+        for ( int i = 0; i < FFTWCache::SLOTS; i++ ) {
+            if ( data[i] != 0 ) {
+                fftw_free ( data[i] );
+            }
+        }
+    }
+};
+static thread_local ThreadBuffers buffers;
+
+/* Gets the plan for a transform. The plan is made on temporary arrays, so it must be executed with the new-array
+ * functions (fftw_execute_r2r, fftw_execute_dft_r2c and fftw_execute_dft_c2r) on arrays from fftw_malloc.
+ * Plans are kept for the life of the process.
+ *
+ * @kind the kind of transform
+ * @rows the number of rows in the transform
+ * @columns the number of columns in the transform
+ * @flags the FFTW planner flags, such as FFTW_MEASURE
+ */
+fftw_plan FFTWCache::getPlan ( Kind kind, int rows, int columns, unsigned flags ) {
+    return getPlan ( kind, rows, columns, 1, flags );
+}
+
+/* Gets the plan for a batch of transforms. The transforms in the batch are stored one after the other, each
+ * taking rows*columns values. Only DCT2 plans can be batched.
+ *
+ * @kind the kind of transform
+ * @rows the number of rows in each transform
+ * @columns the number of columns in each transform
+ * @howmany the number of transforms in the batch
+ * @flags the FFTW planner flags, such as FFTW_MEASURE
+ */
+fftw_plan FFTWCache::getPlan ( Kind kind, int rows, int columns, int howmany, unsigned flags ) {
+
+    std::lock_guard<std::mutex> lock ( plannerMutex );
+
+    PlanKey key ( kind, rows, columns, howmany, flags );
+    std::map<PlanKey, fftw_plan>::iterator it = plans.find ( key );
+    if ( it != plans.end() ) {
+        return it->second;
+    }
+
+    /* Complex arrays hold rows*(columns/2+1) values, which is never more than rows*columns doubles */
+    size_t n = ( size_t ) rows*columns*howmany;
+    size_t nc = ( size_t ) rows* ( columns/2+1 );
+    double * in = fftw_alloc_real ( n );
+    fftw_complex * c = fftw_alloc_complex ( nc );
+    double * out = fftw_alloc_real ( n );
+
+    fftw_plan p = 0;
+    if ( kind == DCT2 ) {
+        int size[2] = { rows, columns };
+        fftw_r2r_kind kinds[2] = { FFTW_REDFT10, FFTW_REDFT10 };
+        p = fftw_plan_many_r2r ( 2, size, howmany, in, 0, 1, rows*columns, out, 0, 1, rows*columns, kinds, flags );
+    } else if ( kind == R2C ) {
+        p = fftw_plan_dft_r2c_2d ( rows, columns, in, c, flags );
+    } else {
+        p = fftw_plan_dft_c2r_2d ( rows, columns, c, out, flags );
+    }
+
+    fftw_free ( out );
+    fftw_free ( c );
+    fftw_free ( in );
+
+    /* FFTW gives no plan when it cannot do the transform, such as when it runs out of memory */
+    if ( p == 0 ) {
+        throw std::runtime_error ( "FFTWCache: FFTW could not make a plan" );
+    }
+
+    plans[key] = p;
+    return p;
+
+}
+
+/* Gets one of the calling thread's scratch buffers, growing it if it is too small. The contents are not kept
+ * when it grows. The buffer stays valid until the same slot is asked for with a larger size, trimBuffers frees it,
+ * or the thread exits.
+ *
+ * @slot which of the thread's buffers to get, from 0 to SLOTS-1
+ * @n the number of doubles needed. A buffer of n doubles also holds n/2 fftw_complex values
+ */
+double * FFTWCache::getBuffer ( int slot, size_t n ) {
+
+    if ( buffers.size[slot] < n ) {
+        if ( buffers.data[slot] != 0 ) {
+            fftw_free ( buffers.data[slot] );
+        }
+        buffers.data[slot] = fftw_alloc_real ( n );
+        buffers.size[slot] = n;
+    }
+    return buffers.data[slot];
+
+}
+
+/* Frees the calling thread's scratch buffers which are larger than KEPT doubles. Callers which ask for large
+ * buffers call this when they are done with them, and the buffers are allocated again the next time they are needed.
+ */
+void FFTWCache::trimBuffers() {
+
+    for ( int i = 0; i < SLOTS; i++ ) {
+        if ( buffers.size[i] > KEPT ) {
+            fftw_free ( buffers.data[i] );
+            buffers.data[i] = 0;
+            buffers.size[i] = 0;
+        }
+    }
+
+}
+
+/* Loads FFTW wisdom from a file, so that plans which were measured before do not need to be measured again.
+ * This should be called before any plans are made.
+ *
+ * @fname the path of the wisdom file
+ */
+bool FFTWCache::loadWisdom ( const std::string & fname ) {
+    std::lock_guard<std::mutex> lock ( plannerMutex );
+    return fftw_import_wisdom_from_filename ( fname.c_str() ) != 0;
+}
+
+/* Saves the FFTW wisdom gathered so far to a file
+ *
+ * @fname the path of the wisdom file
+ */
+bool FFTWCache::saveWisdom ( const std::string & fname ) {
+    std::lock_guard<std::mutex> lock ( plannerMutex );
+    return fftw_export_wisdom_to_filename ( fname.c_str() ) != 0;
+}
@@ -0,0 +1,72 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* A process wide cache of FFTW plans and scratch buffers.
+ *
+ * Planning an FFTW transform costs far more than executing it, especially for small transforms like the 8x8
+ * blocks of the DCT features. The plans are made once per transform shape and flags and then shared by all
+ * threads, since executing a plan on new arrays is thread safe while planning is not. All planning and wisdom
+ * calls are made under one mutex.
+ *
+ * The arrays that the plans are executed on come from per-thread buffers, which are allocated with
+ * fftw_malloc so that they have the alignment the plans expect. Small buffers, like the DCT batches, are kept until
+ * the thread exits. Ones larger than KEPT doubles, like the padded pages of the Gabor filters, are freed by
+ * trimBuffers once the caller is done with them, so that each worker does not hold on to a page's worth of memory.
+ *
+ * Wisdom can be loaded from a file at startup and saved on exit so that FFTW_MEASURE plans are only measured
+ * once per machine.
+ */
+
+#ifndef _fftwcache_h_
+#define _fftwcache_h_
+
+#include <fftw3.h>
+#include <cstddef>
+#include <string>
+
+class FFTWCache {
+public:
+
+    /* The kinds of transforms that can be planned */
+    enum Kind {
+        DCT2,   // 2D DCT-II (REDFT10 in both dimensions), real to real
+        R2C,    // 2D real to complex DFT
+        C2R     // 2D complex to real DFT
+    };
+
+    /* Gets the plan for a transform of the given kind and size, making it the first time it is asked for */
+    static fftw_plan getPlan ( Kind kind, int rows, int columns, unsigned flags );
+    /* Gets the plan for a batch of transforms which are stored one after the other */
+    static fftw_plan getPlan ( Kind kind, int rows, int columns, int howmany, unsigned flags );
+    /* Gets one of the calling thread's scratch buffers, with room for at least n doubles */
+    static double * getBuffer ( int slot, size_t n );
+    /* Frees the calling thread's scratch buffers which are larger than KEPT doubles */
+    static void trimBuffers();
+    /* Loads and saves FFTW wisdom */
+    static bool loadWisdom ( const std::string & fname );
+    static bool saveWisdom ( const std::string & fname );
+
+    /* The number of scratch buffers each thread has */
+    static const int SLOTS = 4;
+    /* The largest scratch buffer, in doubles, that is kept once trimBuffers is called (8 MB) */
+    static const size_t KEPT = ( size_t ) 1 << 20;
+
+};
+
+#endif // _fftwcache_h_
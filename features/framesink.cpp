@@ -0,0 +1,99 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the FrameRing class */
+
+#include "framesink.h"
+#include <algorithm>
+#include <stdexcept>
+
+/* Constructor
+ *
+ * @capacity the number of frames the ring can hold
+ * @size the number of features in each frame
+ */
+FrameRing::FrameRing ( int capacity, int size ) {
+    this->capacity = capacity > 0 ? capacity : 1;
+    this->size = size;
+    values.resize ( ( size_t ) this->capacity*size );
+    numbers.resize ( this->capacity );
+    first = 0;
+    count = 0;
+    lost = 0;
+}
+
+/* Adds a frame to the ring. When the consumer falls behind, the oldest frame is overwritten and counted as dropped
+ *
+ * @n the number of the frame
+ * @features the features of the frame
+ * @size the number of features, which must be the frame size of the ring
+ */
+void FrameRing::putFrame ( long n, const double * features, int size ) {
+
+    if ( size != this->size ) {
+        throw std::invalid_argument ( "FrameRing: a frame does not have the size of the ring's frames" );
+    }
+
+    std::lock_guard<std::mutex> lock ( mutex );
+
+    if ( count == capacity ) {
+        first = ( first+1 ) %capacity;
+        count--;
+        lost++;
+    }
+
+    int slot = ( first+count ) %capacity;
+    std::copy ( features, features+size, values.begin() + ( size_t ) slot*this->size );
+    numbers[slot] = n;
+    count++;
+
+}
+
+/* Takes the oldest frame out of the ring
+ *
+ * @n set to the number of the frame
+ * @features where the features of the frame are copied to
+ */
+bool FrameRing::getFrame ( long & n, double * features ) {
+
+    std::lock_guard<std::mutex> lock ( mutex );
+
+    if ( count == 0 ) {
+        return false;
+    }
+
+    std::copy ( values.begin() + ( size_t ) first*size, values.begin() + ( size_t ) ( first+1 ) *size, features );
+    n = numbers[first];
+    first = ( first+1 ) %capacity;
+    count--;
+    return true;
+
+}
+
+/* The number of frames waiting in the ring */
+int FrameRing::available() {
+    std::lock_guard<std::mutex> lock ( mutex );
+    return count;
+}
+
+/* The number of frames which were overwritten before they were taken */
+long FrameRing::dropped() {
+    std::lock_guard<std::mutex> lock ( mutex );
+    return lost;
+}
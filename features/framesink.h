@@ -0,0 +1,93 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These classes receive the frames of features that are pushed out by the streaming feature classes.
+ *
+ * Rather than returning one vector with every frame once the whole image has been seen, MartiBunke and Holistic
+ * can be fed the image a strip of columns at a time, and each frame is passed to a FrameSink as soon as the
+ * columns it needs have arrived. Frames have a fixed number of features.
+ *
+ * FrameVector collects the frames into one vector. FrameRing keeps a fixed number of the most recent frames,
+ * so that a consumer on another thread can take frames as they are made while the memory used stays fixed.
+ */
+
+#ifndef _framesink_h_
+#define _framesink_h_
+
+#include <vector>
+#include <mutex>
+
+class FrameSink {
+public:
+
+    virtual ~FrameSink() {}
+    /* Receives frame n, which has size features */
+    virtual void putFrame ( long n, const double * features, int size ) = 0;
+
+};
+
+class FrameVector : public FrameSink {
+public:
+
+    /* Constructor
+     * @f the vector that the frames are appended to
+     */
+    FrameVector ( std::vector<double> & f ) : frames ( f ) {
+    }
+    /* Appends a frame. The frames arrive in order, so the number is not needed */
+    void putFrame ( long, const double * features, int size ) {
+        frames.insert ( frames.end(), features, features+size );
+    }
+
+private:
+
+    std::vector<double> & frames;
+
+};
+
+class FrameRing : public FrameSink {
+public:
+
+    /* Constructor */
+    FrameRing ( int capacity, int size );
+
+    /* Adds a frame, overwriting the oldest frame if the ring is full. Throws if it is not the frame size */
+    void putFrame ( long n, const double * features, int size );
+    /* Takes the oldest frame out of the ring. Returns false if the ring is empty */
+    bool getFrame ( long & n, double * features );
+
+    /* The number of frames in the ring */
+    int available();
+    /* The number of frames which were overwritten before they were taken */
+    long dropped();
+
+private:
+
+    std::vector<double> values;
+    std::vector<long> numbers;
+    int capacity;
+    int size;
+    int first;
+    int count;
+    long lost;
+    std::mutex mutex;
+
+};
+
+#endif // _framesink_h_
@@ -36,22 +36,74 @@
 
 /* Implements the Gabor class */
 
-/* Makes use of Octave for feature calculation */
-
 #include "gabor.h"
+#include <math.h>
+#include <algorithm>
 
-/* Default contructor.
- * Takes a string filename as an argument as that is passed to the Octave function which then loads the image.
- *
- * @fname the filename of the image
+/* The kernel cache */
+std::map< std::vector<double>, Gabor::Kernel > Gabor::kernels;
+std::mutex Gabor::kernelsMutex;
+
+/* The cache of kernel spectra. Each spectrum is about the size of the padded image, so the cache is bounded in bytes
+ * rather than by the number of spectra, at 256 MB unless setCacheSize is used
+ */
+std::map< std::vector<double>, Gabor::Spectrum > Gabor::spectra;
+std::mutex Gabor::spectraMutex;
+unsigned long Gabor::spectrumUses = 0;
+size_t Gabor::spectraBytes = 0;
+size_t Gabor::spectraLimit = ( size_t ) 256 << 20;
+
+/* Constructor
+ * Keeps a view of the greyscale image. The pixels are only read from, so nothing is copied
  */
-Gabor::Gabor(std::string fname) {
-    filename = fname;
+Gabor::Gabor ( GrayView v ) {
+    image = v;
+    mode = SPATIAL;
+    spectrum = 0;
+    spectrumRows = 0;
+    spectrumColumns = 0;
+    pool = 0;
 }
 
 /* Destructor */
 Gabor::~Gabor() {
+    if ( spectrum != 0 ) {
+        fftw_free ( spectrum );
+    }
+}
 
+/* Sets how the filters are applied. Both modes give the same responses up to rounding.
+ *
+ * In the frequency domain each Gabor object keeps the spectrum of its padded image, and the kernel spectra are
+ * cached for all objects. Both take 16 bytes for about half of the pixels of the padded image, so a 3000x4000 page
+ * needs about 100 MB for its own spectrum and as much again for each cached filter, up to the size of the cache.
+ *
+ * @m SPATIAL to convolve the image with each kernel, FREQUENCY to multiply the spectra
+ */
+void Gabor::setMode ( Mode m ) {
+    mode = m;
+}
+
+/* Sets a pool to split the work on this image between. The rows of the spatial convolution and the blocks that the
+ * features are counted in are shared out between its threads, and each writes to its own part of the output, so the
+ * features are the same as when the work is done on one thread.
+ *
+ * @p the pool, or 0 to do all of the work on the calling thread
+ */
+void Gabor::setPool ( ThreadPool * p ) {
+    pool = p;
+}
+
+/* Sets the most memory that the cached kernel spectra may take. Spectra which are dropped to keep under it are built
+ * again when they are next needed, and ones in use stay alive until they are done with. A spectrum larger than the
+ * whole cache is built for each image and never kept
+ *
+ * @bytes the size of the cache in bytes
+ */
+void Gabor::setCacheSize ( size_t bytes ) {
+    std::lock_guard<std::mutex> lock ( spectraMutex );
+    spectraLimit = bytes;
+    trimSpectra();
 }
 
 /* Calculates the Gabor filter features.
@@ -68,94 +120,389 @@ Gabor::~Gabor() {
  */
 std::vector<double> Gabor::getGabor(double sxt, double syt, std::vector<double> ft, std::vector<double> thetat, int bh, int bw) {
 
-    sx = sxt;
-    sy = syt;
-    f = ft;
-    theta = thetat;
-    bheight = bh;
-    bwidth = bw;
-
     /* Create the feature vector */
     std::vector<double> fv;
 
-    /* Initialise octave */
-    // Done in source which is executed, otherwise program crashes
-
-    /* Stores the arguments for the octave function */
-    octave_value_list functionArguments;
+    /* The response of the image to the current filter */
+    std::vector<double> gabor;
 
     /* Creates a Gabor filter for each pair of frequencies and orientations and extracts features */
-    for (unsigned int i = 0; i < f.size(); i++) {
-        for (unsigned int j = 0; j < theta.size(); j++) {
-
-            /* Get the function arguments */
-            functionArguments (0) = filename;
-            functionArguments (1) = sx;
-            functionArguments (2) = sy;
-            functionArguments (3) = f.at(i);
-            functionArguments (4) = theta.at(j);
-
-            /* Pass the arguments to the Octave function */
-            const octave_value_list result = feval ("gaborfilter1", functionArguments, 1);
-
-            /* Get the result from the Gabor filter */
-            Matrix gabor = result (1).matrix_value ();
-
-            /* Convert filtered image to features as follows:
-             * 1. Find the mean response of the Gabor filter, M.
-             * 2. Calculate how many responses in the entire image exceed the mean response, N.
-             * 3. Partition the image into blocks.
-             * 4. Calculate how many responses in each block exceed the mean response for the whole image, Nb.
-             * 5. Feature is given by (Nb/N) and added to the feature vector.
-             */
-
-            /* Calculate the mean */
-            double mean = 0;
-            for (int k = 0; k < gabor.rows(); k++) {
-                for (int l = 0; l < gabor.columns(); l++) {
-                    mean = mean+gabor(k,l);
+    for (unsigned int i = 0; i < ft.size(); i++) {
+        for (unsigned int j = 0; j < thetat.size(); j++) {
+
+            /* Filter the image */
+            getResponse ( sxt, syt, ft.at(i), thetat.at(j), gabor );
+
+            /* Convert filtered image to features */
+            addFeatures ( gabor, bh, bw, fv );
+
+        }
+    }
+
+    /* The frequency domain filters use scratch arrays the size of the padded page, which are not kept */
+    FFTWCache::trimBuffers();
+
+    /* Return the feature vector */
+    return fv;
+
+}
+
+/* Gets the kernel of a Gabor filter, building it the same way as gaborfilter1.m does.
+ * The sinusoid in gaborfilter1.m is exp(2*pi*f*x') rather than a complex exponential, so the kernel is real and
+ * the imaginary part of its response is zero.
+ *
+ * @sx variance along x-axis (shape of Gaussian)
+ * @sy variance along y-axis (shape of Gaussian)
+ * @f the frequency of the sinusoid
+ * @theta the orientation of the filter
+ */
+const Gabor::Kernel & Gabor::getKernel ( double sx, double sy, double f, double theta ) {
+
+    std::vector<double> key ( 4 );
+    key[0] = sx;
+    key[1] = sy;
+    key[2] = f;
+    key[3] = theta;
+
+    /* Kernels are never removed from the cache, so a reference to one stays valid once the lock is released */
+    std::lock_guard<std::mutex> lock ( kernelsMutex );
+    std::map< std::vector<double>, Kernel >::iterator it = kernels.find ( key );
+    if ( it != kernels.end() ) {
+        return it->second;
+    }
+
+    Kernel & k = kernels[key];
+    int nx = ( int ) sx;
+    int ny = ( int ) sy;
+    k.rows = 2*nx+1;
+    k.columns = 2*ny+1;
+    k.values.resize ( k.rows*k.columns );
+
+    for ( int x = -nx; x <= nx; x++ ) {
+        for ( int y = -ny; y <= ny; y++ ) {
+            double xPrime = x * cos ( theta ) + y * sin ( theta );
+            double yPrime = y * cos ( theta ) - x * sin ( theta );
+            k.values[( nx+x ) *k.columns + ny+y] = ( 1/ ( 2*M_PI*sx*sy ) ) *exp ( -.5* ( pow ( xPrime/sx, 2 ) + pow ( yPrime/sy, 2 ) ) ) *exp ( 2*M_PI*f*xPrime );
+        }
+    }
+
+    return k;
+
+}
+
+/* Gets the magnitude of the response of the image to a Gabor filter. This is the same as conv2(I, G, 'same'),
+ * with the image taken as zero outside its edges.
+ *
+ * @sx variance along x-axis (shape of Gaussian)
+ * @sy variance along y-axis (shape of Gaussian)
+ * @f the frequency of the sinusoid
+ * @theta the orientation of the filter
+ * @response the magnitude of the response at each pixel, one row after the other
+ */
+void Gabor::getResponse ( double sx, double sy, double f, double theta, std::vector<double> & response ) {
+    if ( mode == FREQUENCY ) {
+        getFrequencyResponse ( sx, sy, f, theta, response );
+    } else {
+        getSpatialResponse ( sx, sy, f, theta, response );
+    }
+}
+
+/* Applies a filter by direct convolution. See getResponse */
+void Gabor::getSpatialResponse ( double sx, double sy, double f, double theta, std::vector<double> & response ) {
+
+    const Kernel & k = getKernel ( sx, sy, f, theta );
+    int rows = image.rows();
+    int columns = image.columns();
+    int cr = k.rows/2;
+    int cc = k.columns/2;
+
+    response.assign ( ( size_t ) rows*columns, 0.0 );
+
+    /* Add each tap of the kernel to whole rows of the response at a time. Pixel (i-a, j-b) is weighted by
+     * kernel value (a+cr, b+cc)
+     */
+    ThreadPool::parallelFor ( pool, 0, rows, [&] ( int first, int last ) {
+        for ( int i = first; i < last; i++ ) {
+            double * out = &response[( size_t ) i*columns];
+            for ( int a = -cr; a <= cr; a++ ) {
+                if ( i-a < 0 || i-a >= rows ) {
+                    continue;
                 }
-            }
-            mean = mean/(gabor.rows()*gabor.columns());
-
-            /* Count number of responses which exceed mean */
-            double N = 0;
-            for (int k = 0; k < gabor.rows(); k++) {
-                for (int l = 0; l < gabor.columns(); l++) {
-                    if (gabor(k,l) > mean) {
-                        N++;
+                const float * in = image.row ( i-a );
+                const double * kr = &k.values[( a+cr ) *k.columns];
+                for ( int b = -cc; b <= cc; b++ ) {
+                    double w = kr[b+cc];
+                    int start = b > 0 ? b : 0;
+                    int end = b < 0 ? columns+b : columns;
+                    for ( int j = start; j < end; j++ ) {
+                        out[j] += w*in[j-b];
                     }
                 }
             }
-            if (N == 0) {
-                N = 1;
+            /* Only the magnitude is needed */
+            for ( int j = 0; j < columns; j++ ) {
+                out[j] = fabs ( out[j] );
             }
+        }
+    } );
 
-            /* Partitioni into blocks, count how many responses exceed mean, and calculate feature */
-            for (int k = 0; k < gabor.rows(); k+=bh) {
-                for (int l = 0; l < gabor.columns(); l+=bw) {
+}
 
-                    double Nb = 0;
-                    for (int x = k; x < k+bh; x++) {
-                        for (int y = l; y < l+bw; y++) {
-                            if (gabor(x,y) > mean) {
-                                Nb++;
-                            }
-                        }
-                    }
+/* Applies a filter in the frequency domain. See getResponse.
+ *
+ * The image is zero padded so that the circular convolution done by the transforms does not wrap around, and
+ * the kernel is stored with its centre at the origin so that the response lines up with the image.
+ * The image is only transformed the first time, after which each filter is a product of spectra and one
+ * inverse transform. The plans and the scratch arrays come from the FFTWCache, so several threads can apply
+ * filters at once.
+ */
+void Gabor::getFrequencyResponse ( double sx, double sy, double f, double theta, std::vector<double> & response ) {
 
-                    /* Add the feature to the vector */
-                    fv.push_back(Nb/N);
+    int rows = image.rows();
+    int columns = image.columns();
+    int paddedRows = getPaddedSize ( rows + ( int ) sx );
+    int paddedColumns = getPaddedSize ( columns + ( int ) sy );
+    int half = paddedColumns/2+1;
+
+    response.assign ( ( size_t ) rows*columns, 0.0 );
+    if ( rows == 0 || columns == 0 ) {
+        return;
+    }
+
+    /* Transform the image if it has not been transformed at this size yet */
+    bool transform = false;
+    if ( spectrum == 0 || spectrumRows != paddedRows || spectrumColumns != paddedColumns ) {
+        if ( spectrum != 0 ) {
+            fftw_free ( spectrum );
+        }
+        spectrum = fftw_alloc_complex ( ( size_t ) paddedRows*half );
+        spectrumRows = paddedRows;
+        spectrumColumns = paddedColumns;
+        transform = true;
+    }
 
+    size_t n = ( size_t ) paddedRows*half;
+    double * real = FFTWCache::getBuffer ( 2, ( size_t ) paddedRows*paddedColumns );
+    fftw_complex * product = ( fftw_complex * ) FFTWCache::getBuffer ( 3, 2*n );
+    if ( transform ) {
+        for ( int i = 0; i < paddedRows; i++ ) {
+            double * out = real + ( size_t ) i*paddedColumns;
+            int j = 0;
+            if ( i < rows ) {
+                const float * in = image.row ( i );
+                for ( ; j < columns; j++ ) {
+                    out[j] = in[j];
                 }
             }
+            for ( ; j < paddedColumns; j++ ) {
+                out[j] = 0;
+            }
+        }
+        fftw_execute_dft_r2c ( FFTWCache::getPlan ( FFTWCache::R2C, paddedRows, paddedColumns, FFTW_ESTIMATE ), real, spectrum );
+    }
+
+    /* Multiply by the spectrum of the kernel */
+    std::shared_ptr< const std::vector<double> > kernel = getSpectrum ( paddedRows, paddedColumns, sx, sy, f, theta );
+    const double * k = &( *kernel ) [0];
+    for ( size_t l = 0; l < n; l++ ) {
+        double re = spectrum[l][0];
+        double im = spectrum[l][1];
+        product[l][0] = re*k[2*l] - im*k[2*l+1];
+        product[l][1] = re*k[2*l+1] + im*k[2*l];
+    }
 
+    /* Transform back. The kernel spectrum is already scaled, so only the magnitude is needed */
+    fftw_execute_dft_c2r ( FFTWCache::getPlan ( FFTWCache::C2R, paddedRows, paddedColumns, FFTW_ESTIMATE ), product, real );
+    for ( int i = 0; i < rows; i++ ) {
+        const double * in = real + ( size_t ) i*paddedColumns;
+        double * out = &response[( size_t ) i*columns];
+        for ( int j = 0; j < columns; j++ ) {
+            out[j] = fabs ( in[j] );
         }
     }
 
+}
 
-    /* Return the feature vector */
-    return fv;
+/* Gets the spectrum of a kernel at a padded size, scaled by 1/(rows*columns) so that the inverse transform needs no
+ * further scaling. The spectrum is stored as interleaved real and imaginary parts.
+ * Spectra are built outside of the lock, so several threads can build different ones at once. The caller shares the
+ * spectrum, so it stays valid even if it is dropped from the cache.
+ *
+ * @rows the number of rows in the padded image
+ * @columns the number of columns in the padded image
+ * @sx variance along x-axis (shape of Gaussian)
+ * @sy variance along y-axis (shape of Gaussian)
+ * @f the frequency of the sinusoid
+ * @theta the orientation of the filter
+ */
+std::shared_ptr< const std::vector<double> > Gabor::getSpectrum ( int rows, int columns, double sx, double sy, double f, double theta ) {
+
+    std::vector<double> key ( 6 );
+    key[0] = rows;
+    key[1] = columns;
+    key[2] = sx;
+    key[3] = sy;
+    key[4] = f;
+    key[5] = theta;
+
+    {
+        std::lock_guard<std::mutex> lock ( spectraMutex );
+        std::map< std::vector<double>, Spectrum >::iterator it = spectra.find ( key );
+        if ( it != spectra.end() ) {
+            it->second.used = ++spectrumUses;
+            return it->second.values;
+        }
+    }
+
+    /* Place the kernel with its centre at the origin, wrapping the negative offsets around */
+    const Kernel & k = getKernel ( sx, sy, f, theta );
+    int cr = k.rows/2;
+    int cc = k.columns/2;
+    double scale = 1.0/ ( ( double ) rows*columns );
+    size_t n = ( size_t ) rows* ( columns/2+1 );
+    double * real = FFTWCache::getBuffer ( 2, ( size_t ) rows*columns );
+    fftw_complex * product = ( fftw_complex * ) FFTWCache::getBuffer ( 3, 2*n );
+    std::fill ( real, real + ( size_t ) rows*columns, 0.0 );
+    for ( int a = -cr; a <= cr; a++ ) {
+        double * out = real + ( size_t ) ( ( a+rows ) %rows ) *columns;
+        for ( int b = -cc; b <= cc; b++ ) {
+            out[( b+columns ) %columns] = k.values[( a+cr ) *k.columns + b+cc]*scale;
+        }
+    }
+
+    /* The scratch arrays are free to use here, since they are overwritten for every filter */
+    fftw_execute_dft_r2c ( FFTWCache::getPlan ( FFTWCache::R2C, rows, columns, FFTW_ESTIMATE ), real, product );
+    std::shared_ptr< std::vector<double> > values ( new std::vector<double> ( 2*n ) );
+    std::vector<double> & s = *values;
+    for ( size_t l = 0; l < n; l++ ) {
+        s[2*l] = product[l][0];
+        s[2*l+1] = product[l][1];
+    }
+
+    /* Keep it, unless another thread got there first, and drop the least recently used spectra to make room */
+    std::lock_guard<std::mutex> lock ( spectraMutex );
+    Spectrum & cached = spectra[key];
+    if ( !cached.values ) {
+        cached.values = values;
+        spectraBytes += s.size() *sizeof ( double );
+    }
+    cached.used = ++spectrumUses;
+    std::shared_ptr< const std::vector<double> > result = cached.values;
+    trimSpectra();
+    return result;
+
+}
+
+/* Drops the least recently used spectra until the cache is within its size. Must be called with the lock held */
+void Gabor::trimSpectra() {
+    while ( spectraBytes > spectraLimit && !spectra.empty() ) {
+        std::map< std::vector<double>, Spectrum >::iterator oldest = spectra.begin();
+        for ( std::map< std::vector<double>, Spectrum >::iterator it = spectra.begin(); it != spectra.end(); it++ ) {
+            if ( it->second.used < oldest->second.used ) {
+                oldest = it;
+            }
+        }
+        spectraBytes -= oldest->second.values->size() *sizeof ( double );
+        spectra.erase ( oldest );
+    }
+}
+
+/* Gets the smallest size of at least n whose only prime factors are 2, 3, 5 and 7, which FFTW transforms
+ * quickly
+ *
+ * @n the smallest allowed size
+ */
+int Gabor::getPaddedSize ( int n ) {
+
+    for ( int m = n > 1 ? n : 1; ; m++ ) {
+        int r = m;
+        while ( r%2 == 0 ) {
+            r /= 2;
+        }
+        while ( r%3 == 0 ) {
+            r /= 3;
+        }
+        while ( r%5 == 0 ) {
+            r /= 5;
+        }
+        while ( r%7 == 0 ) {
+            r /= 7;
+        }
+        if ( r == 1 ) {
+            return m;
+        }
+    }
 
 }
 
+/* Convert filtered image to features as follows:
+ * 1. Find the mean response of the Gabor filter, M.
+ * 2. Calculate how many responses in the entire image exceed the mean response, N.
+ * 3. Partition the image into blocks.
+ * 4. Calculate how many responses in each block exceed the mean response for the whole image, Nb.
+ * 5. Feature is given by (Nb/N) and added to the feature vector.
+ *
+ * Only the order of the responses matters, so the features do not depend on whether the pixels are in
+ * [0;1] or [0;255] as they were when Octave read the image from disk.
+ *
+ * @response the magnitude of the filter response
+ * @bh block height
+ * @bw block width
+ * @fv the feature vector to add the features to
+ */
+void Gabor::addFeatures ( const std::vector<double> & response, int bh, int bw, std::vector<double> & fv ) {
+
+    int rows = image.rows();
+    int columns = image.columns();
+
+    /* Calculate the mean */
+    double mean = 0;
+    for ( size_t k = 0; k < response.size(); k++ ) {
+        mean = mean+response[k];
+    }
+    mean = mean/ ( rows*columns );
+
+    /* Count number of responses which exceed mean */
+    double N = 0;
+    for ( size_t k = 0; k < response.size(); k++ ) {
+        if ( response[k] > mean ) {
+            N++;
+        }
+    }
+    if (N == 0) {
+        N = 1;
+    }
+
+    /* Partition into blocks, count how many responses exceed mean, and calculate feature.
+     * Blocks at the edges only count the responses inside the image
+     */
+    int blockRows = ( rows+bh-1 ) /bh;
+    int blockColumns = ( columns+bw-1 ) /bw;
+    size_t start = fv.size();
+    fv.resize ( start + ( size_t ) blockRows*blockColumns );
+
+    /* Each row of blocks writes its features to its own part of the vector */
+    ThreadPool::parallelFor ( pool, 0, blockRows, [&] ( int begin, int end ) {
+        for (int kb = begin; kb < end; kb++) {
+            int k = kb*bh;
+            double * features = &fv[start + ( size_t ) kb*blockColumns];
+            for (int l = 0; l < columns; l+=bw) {
+
+                double Nb = 0;
+                for (int x = k; x < k+bh && x < rows; x++) {
+                    const double * row = &response[( size_t ) x*columns];
+                    for (int y = l; y < l+bw && y < columns; y++) {
+                        if (row[y] > mean) {
+                            Nb++;
+                        }
+                    }
+                }
+
+                /* Add the feature to the vector */
+                *features++ = Nb/N;
+
+            }
+        }
+    } );
+
+}
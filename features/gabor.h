@@ -34,21 +34,33 @@
  *
  */
 
-/* This class implements the Histogram of Ofiented Gradients feature */
+/* This class implements the Gabor filter feature */
 
-/* Makes use of Octave for feature calculation */
+/* The filters are built and applied in C++. Each filter is the same as the one made by gaborfilter1.m, which
+ * this class used to call through Octave, and the filter kernels are cached so that they are only built once.
+ *
+ * The filters can either be applied by convolution in the spatial domain, or in the frequency domain. In the
+ * frequency domain the image is transformed once and each filter only costs a product with the cached
+ * spectrum of its kernel and one inverse transform. This is much faster for large images and filter banks.
+ *
+ * The spectra take memory though. Each one holds 16 bytes for every pixel of the padded image, about half of it,
+ * so for a page every filter spectrum and the image spectrum are some 100 MB each. The kernel spectra of all
+ * sizes share one cache which is bounded in bytes (see setCacheSize). Once it is full the least recently used
+ * spectra are dropped and built again when they are next needed.
+ */
 
 
 #ifndef _gabor_h_
 #define _gabor_h_
 
-#include <Magick++.h>
 #include <vector>
-#include <octave/oct.h>
-#include <octave/octave.h>
-#include <octave/parse.h>
-#include <octave/toplev.h>
-#include <octave/parse.h>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <fftw3.h>
+#include "fftwcache.h"
+#include "grayimage.h"
+#include "threadpool.h"
 
 #define PI 3.14159265
 
@@ -57,23 +69,82 @@ class Gabor
 
 public:
 
+    /* The ways in which the filters can be applied */
+    enum Mode { SPATIAL, FREQUENCY };
+
     /* Constructor */
-    Gabor(std::string fname);
+    Gabor ( GrayView v );
     /* Destructor */
     ~Gabor();
     /* Gets the features */
     std::vector<double> getGabor(double sxt, double syt, std::vector<double> ft, std::vector<double> thetat, int bh, int bw);
+    /* Gets the magnitude of the response of the image to one filter */
+    void getResponse ( double sx, double sy, double f, double theta, std::vector<double> & response );
+    /* Sets how the filters are applied. Filters are applied in the spatial domain by default */
+    void setMode ( Mode m );
+    /* Sets a pool to split the work on this image between. The work is done on the calling thread by default */
+    void setPool ( ThreadPool * p );
+    /* Sets the most memory, in bytes, that the cached kernel spectra of all Gabor objects may take */
+    static void setCacheSize ( size_t bytes );
 
 private:
 
-    Magick::Image * image;
-    std::string filename;
-    double sx;
-    double sy;
-    std::vector<double> f;
-    std::vector<double> theta;
-    int bheight;
-    int bwidth;
+    /* Not copyable since the image spectrum is owned by the object */
+    Gabor ( const Gabor & );
+    Gabor & operator= ( const Gabor & );
+
+    /* A filter kernel. Rows run along the x-axis of the filter, which is applied down the rows of the image */
+    struct Kernel {
+        int rows;
+        int columns;
+        std::vector<double> values;
+    };
+
+    /* Gets the kernel for the given parameters from the cache, building it if it is not there yet */
+    static const Kernel & getKernel ( double sx, double sy, double f, double theta );
+    /* The spectrum of a kernel at one padded image size, shared by all images which pad to that size, and when it was
+     * last used
+     */
+    struct Spectrum {
+        std::shared_ptr< const std::vector<double> > values;
+        unsigned long used;
+    };
+
+    /* Applies a filter in the spatial domain */
+    void getSpatialResponse ( double sx, double sy, double f, double theta, std::vector<double> & response );
+    /* Applies a filter in the frequency domain */
+    void getFrequencyResponse ( double sx, double sy, double f, double theta, std::vector<double> & response );
+    /* Gets the spectrum of a kernel at a padded size, building it if needed */
+    static std::shared_ptr< const std::vector<double> > getSpectrum ( int rows, int columns, double sx, double sy, double f,
+            double theta );
+    /* Drops the least recently used spectra until the cache is within its size */
+    static void trimSpectra();
+    /* Gets the smallest size of at least n which FFTW transforms quickly */
+    static int getPaddedSize ( int n );
+    /* Converts a filter response to features */
+    void addFeatures ( const std::vector<double> & response, int bh, int bw, std::vector<double> & fv );
+
+    /* The cache of kernels, shared by all Gabor objects */
+    static std::map< std::vector<double>, Kernel > kernels;
+    static std::mutex kernelsMutex;
+
+    /* The cache of kernel spectra, keyed by padded size and kernel, the bytes they take and the most they may take */
+    static std::map< std::vector<double>, Spectrum > spectra;
+    static std::mutex spectraMutex;
+    static unsigned long spectrumUses;
+    static size_t spectraBytes;
+    static size_t spectraLimit;
+
+    GrayView image;
+    Mode mode;
+    ThreadPool * pool;
+
+    /* The spectrum of the image and its padded size, which are only made once the first filter is applied in the
+     * frequency domain
+     */
+    fftw_complex * spectrum;
+    int spectrumRows;
+    int spectrumColumns;
 
 };
 
@@ -0,0 +1,379 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the GrayImage, GrayView, BinaryImage and ColumnRuns classes */
+
+#include "grayimage.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Default constructor creates an empty image */
+GrayImage::GrayImage() {
+    width = 0;
+    height = 0;
+}
+
+/* Constructor
+ * Decodes the image into the pixel array in a single call rather than one pixelColor call per pixel.
+ * The green channel is exported since that is the value ColorGray::shade() returns, which for colour images is
+ * neither the red channel nor the luminance.
+ *
+ * @i pointer to the image to decode
+ */
+GrayImage::GrayImage ( Magick::Image * i ) {
+    width = i->columns();
+    height = i->rows();
+    pixels.resize ( ( size_t ) width*height );
+    if ( width > 0 && height > 0 ) {
+        i->write ( 0, 0, width, height, "G", Magick::FloatPixel, &pixels[0] );
+    }
+}
+
+/* Destructor */
+GrayImage::~GrayImage() {
+
+}
+
+/* Gets a copy of a view with rows and columns swapped. Row x of the copy holds column x of the view from top to
+ * bottom, which lets column-wise features walk each column through contiguous memory.
+ * The copy is made in small tiles so that both the reads and the writes stay in cache.
+ *
+ * @v the view to transpose
+ */
+GrayImage GrayImage::transpose ( GrayView v ) {
+
+    GrayImage t;
+    t.width = v.rows();
+    t.height = v.columns();
+    t.pixels.resize ( ( size_t ) t.width*t.height );
+
+    const int tile = 32;
+    for ( int y0 = 0; y0 < v.rows(); y0 += tile ) {
+        int y1 = y0+tile < v.rows() ? y0+tile : v.rows();
+        for ( int x0 = 0; x0 < v.columns(); x0 += tile ) {
+            int x1 = x0+tile < v.columns() ? x0+tile : v.columns();
+            for ( int y = y0; y < y1; y++ ) {
+                const float * in = v.row ( y );
+                for ( int x = x0; x < x1; x++ ) {
+                    t.pixels[( size_t ) x*t.width+y] = in[x];
+                }
+            }
+        }
+    }
+
+    return t;
+
+}
+
+/* Gets a view of a region of this view. Regions which run past the edge are clipped, so no pixels are copied.
+ *
+ * @x the column of the top left corner of the region
+ * @y the row of the top left corner of the region
+ * @w the width of the region
+ * @h the height of the region
+ */
+GrayView GrayView::region ( int x, int y, int w, int h ) const {
+
+    /* Clip the region to the view */
+    if ( x < 0 ) {
+        w += x;
+        x = 0;
+    }
+    if ( y < 0 ) {
+        h += y;
+        y = 0;
+    }
+    if ( x+w > width ) {
+        w = width-x;
+    }
+    if ( y+h > height ) {
+        h = height-y;
+    }
+    if ( w <= 0 || h <= 0 ) {
+        return GrayView();
+    }
+
+    return GrayView ( row ( y ) + x, w, h, stride );
+
+}
+
+/* Default constructor creates an empty image */
+BinaryImage::BinaryImage() {
+    width = 0;
+    height = 0;
+    stride = 0;
+    exact = true;
+}
+
+/* Constructor
+ * Thresholds every pixel of the view once, and notes whether the view was already binary
+ *
+ * @v the view to threshold
+ */
+BinaryImage::BinaryImage ( GrayView v ) {
+    width = v.columns();
+    height = v.rows();
+    stride = ( width+63 ) /64;
+    bits.assign ( ( size_t ) stride*height, 0 );
+    exact = true;
+    for ( int y = 0; y < height; y++ ) {
+        if ( threshold ( v.row ( y ), width, &bits[( size_t ) y*stride] ) == false ) {
+            exact = false;
+        }
+    }
+}
+
+/* Destructor */
+BinaryImage::~BinaryImage() {
+
+}
+
+/* Counts the foreground pixels in part of a row. The words at either end are masked down to the part
+ *
+ * @row the row
+ * @x0 the first pixel
+ * @x1 one past the last pixel
+ */
+int BinaryImage::count ( const uint64_t * row, int x0, int x1 ) {
+
+    if ( x0 >= x1 ) {
+        return 0;
+    }
+
+    int first = x0/64;
+    int last = ( x1-1 ) /64;
+    uint64_t head = ~0ULL << ( x0%64 );
+    uint64_t tail = ~0ULL >> ( 63 - ( x1-1 ) %64 );
+
+    if ( first == last ) {
+        return __builtin_popcountll ( row[first] & head & tail );
+    }
+    int n = __builtin_popcountll ( row[first] & head );
+    for ( int w = first+1; w < last; w++ ) {
+        n += __builtin_popcountll ( row[w] );
+    }
+    return n + __builtin_popcountll ( row[last] & tail );
+
+}
+
+/* Thresholds a row of pixels into bits, >=0.5 = foreground (1), <0.5 = background (0). The words that the row
+ * covers are overwritten, so the bits past the end are cleared
+ *
+ * @in the pixels
+ * @n the number of pixels
+ * @out the bits
+ */
+bool BinaryImage::threshold ( const float * in, int n, uint64_t * out ) {
+
+    bool binary = true;
+    for ( int w = 0; w*64 < n; w++ ) {
+
+        int i = w*64;
+        int end = i+64 < n ? i+64 : n;
+        uint64_t word = 0;
+        int j = i;
+#ifdef __SSE2__
+        /* Four pixels at a time. The comparison masks give the bits, and the pixels that are neither 0 nor 1 */
+        const __m128 half = _mm_set1_ps ( 0.5f );
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps ( 1.0f );
+        int other = 0;
+        for ( ; j+4 <= end; j+=4 ) {
+            __m128 p = _mm_loadu_ps ( in+j );
+            word |= ( uint64_t ) _mm_movemask_ps ( _mm_cmpge_ps ( p, half ) ) << ( j-i );
+            other |= _mm_movemask_ps ( _mm_or_ps ( _mm_cmpeq_ps ( p, zero ), _mm_cmpeq_ps ( p, one ) ) ) ^ 0xF;
+        }
+        if ( other != 0 ) {
+            binary = false;
+        }
+#endif
+        for ( ; j < end; j++ ) {
+            if ( in[j] >= 0.5 ) {
+                word |= 1ULL << ( j-i );
+            }
+            if ( in[j] != 0 && in[j] != 1 ) {
+                binary = false;
+            }
+        }
+        out[w] = word;
+
+    }
+    return binary;
+
+}
+
+/* Default constructor creates an empty image */
+ColumnRuns::ColumnRuns() {
+    width = 0;
+    height = 0;
+    exact = true;
+    offsets.assign ( 1, 0 );
+}
+
+/* Constructor
+ * Thresholds the columns of a view into runs. The view is transposed and thresholded into bits first, so that
+ * each column is scanned as one row of words
+ *
+ * @v the view
+ */
+ColumnRuns::ColumnRuns ( GrayView v ) {
+    GrayImage t = GrayImage::transpose ( v );
+    build ( BinaryImage ( t.view() ) );
+}
+
+/* Constructor
+ * Takes the runs from a thresholded image whose rows are the columns, as given by thresholding GrayImage::transpose
+ *
+ * @t the transposed image thresholded
+ */
+ColumnRuns::ColumnRuns ( const BinaryImage & t ) {
+    build ( t );
+}
+
+/* Destructor */
+ColumnRuns::~ColumnRuns() {
+
+}
+
+/* Finds the runs of each row of bits in one pass along it. Within a word, the lowest set bit starts a run and the
+ * lowest clear bit above it ends it, so each run costs two bit scans however long it is, and words of background
+ * are skipped whole
+ *
+ * @t the transposed image thresholded
+ */
+void ColumnRuns::build ( const BinaryImage & t ) {
+
+    width = t.rows();
+    height = t.columns();
+    exact = t.isExact();
+    runs.clear();
+    offsets.assign ( ( size_t ) width+1, 0 );
+
+    for ( int x = 0; x < width; x++ ) {
+
+        const uint64_t * row = t.row ( x );
+        int start = -1;
+        for ( int w = 0; w < t.words(); w++ ) {
+            /* Outside a run look for the next set bit, and inside one for the next clear bit */
+            uint64_t word = row[w];
+            uint64_t unscanned = ~0ULL;
+            while ( true ) {
+                uint64_t rest = ( start < 0 ? word : ~word ) & unscanned;
+                if ( rest == 0 ) {
+                    break;
+                }
+                int b = __builtin_ctzll ( rest );
+                unscanned = ~0ULL << b;
+                if ( start < 0 ) {
+                    start = w*64 + b;
+                } else {
+                    Run r = { start, w*64 + b };
+                    runs.push_back ( r );
+                    start = -1;
+                }
+            }
+        }
+        /* A run that reaches the bottom of the column. The bits past the end are clear, so only a run that fills the
+         * last word gets here
+         */
+        if ( start >= 0 ) {
+            Run r = { start, height };
+            runs.push_back ( r );
+        }
+        offsets[x+1] = runs.size();
+
+    }
+
+}
+
+/* Gets a pixel from the runs of its column
+ *
+ * @x the column
+ * @y the row
+ */
+bool ColumnRuns::pixel ( int x, int y ) const {
+    for ( const Run * r = begin ( x ); r != end ( x ) && r->start <= y; r++ ) {
+        if ( y < r->end ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Counts the foreground pixels in part of a column from the overlap of each run with it
+ *
+ * @x the column
+ * @y0 the first row
+ * @y1 one past the last row
+ */
+int ColumnRuns::count ( int x, int y0, int y1 ) const {
+    int n = 0;
+    for ( const Run * r = begin ( x ); r != end ( x ) && r->start < y1; r++ ) {
+        int s = r->start > y0 ? r->start : y0;
+        int e = r->end < y1 ? r->end : y1;
+        if ( s < e ) {
+            n += e-s;
+        }
+    }
+    return n;
+}
+
+/* Finds the first foreground pixel from row y0 down a column
+ *
+ * @x the column
+ * @y0 the first row
+ */
+int ColumnRuns::first ( int x, int y0 ) const {
+    for ( const Run * r = begin ( x ); r != end ( x ); r++ ) {
+        if ( r->end > y0 ) {
+            return r->start > y0 ? r->start : y0;
+        }
+    }
+    return -1;
+}
+
+/* Finds the last foreground pixel from row y0 down a column
+ *
+ * @x the column
+ * @y0 the first row
+ */
+int ColumnRuns::last ( int x, int y0 ) const {
+    if ( begin ( x ) == end ( x ) ) {
+        return -1;
+    }
+    int y = end ( x ) [-1].end-1;
+    return y >= y0 ? y : -1;
+}
+
+/* Counts the changes of colour from row y0 down a column. Each run that reaches past row y0 starts with a change,
+ * taking the row above y0 as background, and ends with one unless it reaches the bottom of the column
+ *
+ * @x the column
+ * @y0 the first row
+ */
+int ColumnRuns::transitions ( int x, int y0 ) const {
+    int n = 0;
+    for ( const Run * r = begin ( x ); r != end ( x ); r++ ) {
+        if ( r->end > y0 ) {
+            n += r->end < height ? 2 : 1;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,255 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These classes hold a greyscale copy of an image as one contiguous row-major array of floats.
+ *
+ * The image is decoded once into a GrayImage, giving the same values as
+ * Magick::ColorGray(image->pixelColor(x,y)).shade(), so that the feature classes can walk the pixels
+ * directly instead of going through the ImageMagick pixel cache for every read.
+ *
+ * The feature classes only ever read pixels through a GrayView, which points into the pixels of a
+ * GrayImage without owning or copying them. A view can also cover just a region of the image.
+ *
+ * Features which only look at whether pixels are foreground can share a BinaryImage, which holds the image
+ * thresholded once at 0.5 and packed 64 pixels to a word, so that pixels can be counted and compared a word at a
+ * time with popcounts, shifts and xors. A word image then takes up a few kilobytes and fits in the L1 cache.
+ *
+ * Features which look down the columns for where the foreground starts and stops can share a ColumnRuns, which
+ * holds the foreground of each column of a thresholded image as runs of rows. Word images are mostly background,
+ * so a column has only a few runs however tall it is.
+ */
+
+#ifndef _grayimage_h_
+#define _grayimage_h_
+
+#include <Magick++.h>
+#include <vector>
+#include <stdint.h>
+
+class GrayView {
+public:
+
+    /* Constructors */
+    GrayView () {
+        data = 0;
+        width = 0;
+        height = 0;
+        stride = 0;
+    }
+    GrayView ( const float * d, int w, int h, int s ) {
+        data = d;
+        width = w;
+        height = h;
+        stride = s;
+    }
+
+    /* The dimensions of the view */
+    int columns() const {
+        return width;
+    }
+    int rows() const {
+        return height;
+    }
+
+    /* Pointer to the first pixel of row y */
+    const float * row ( int y ) const {
+        return data + ( size_t ) y*stride;
+    }
+
+    /* Gets the pixel at (x,y). Coordinates outside of the view are clamped to the nearest edge pixel,
+     * which is what pixelColor returns for them.
+     */
+    float pixel ( int x, int y ) const {
+        if ( x < 0 ) {
+            x = 0;
+        } else if ( x >= width ) {
+            x = width-1;
+        }
+        if ( y < 0 ) {
+            y = 0;
+        } else if ( y >= height ) {
+            y = height-1;
+        }
+        return data[( size_t ) y*stride+x];
+    }
+
+    /* Gets a view of the region at (x,y) with size w*h. The region is clipped like Magick::Image::crop */
+    GrayView region ( int x, int y, int w, int h ) const;
+
+private:
+
+    const float * data;
+    int width;
+    int height;
+    int stride;
+
+};
+
+class GrayImage {
+public:
+
+    /* Constructors */
+    GrayImage ();
+    GrayImage ( Magick::Image * i );
+    /* Destructor */
+    ~GrayImage ();
+
+    /* The dimensions of the image */
+    int columns() const {
+        return width;
+    }
+    int rows() const {
+        return height;
+    }
+
+    /* Gets a view of the whole image */
+    GrayView view() const {
+        return GrayView ( pixels.empty() ? 0 : &pixels[0], width, height, width );
+    }
+
+    /* Gets a copy of a view with rows and columns swapped, so that each column of the view is one row of the copy */
+    static GrayImage transpose ( GrayView v );
+
+private:
+
+    std::vector<float> pixels;
+    int width;
+    int height;
+
+};
+
+class BinaryImage {
+public:
+
+    /* Constructors */
+    BinaryImage ();
+    BinaryImage ( GrayView v );
+    /* Destructor */
+    ~BinaryImage ();
+
+    /* The dimensions of the image */
+    int columns() const {
+        return width;
+    }
+    int rows() const {
+        return height;
+    }
+    /* The number of words in each row */
+    int words() const {
+        return stride;
+    }
+
+    /* Pointer to the first word of row y. Pixel x is bit x%64 of word x/64, and is set for foreground pixels.
+     * The bits past the end of the row are clear
+     */
+    const uint64_t * row ( int y ) const {
+        return &bits[( size_t ) y*stride];
+    }
+
+    /* Gets the pixel at (x,y) */
+    bool pixel ( int x, int y ) const {
+        return ( row ( y ) [x/64] >> ( x%64 ) ) & 1;
+    }
+
+    /* Whether every pixel of the image was exactly 0 or 1. If so the bits are the pixel values themselves, and
+     * not just whether they are foreground
+     */
+    bool isExact() const {
+        return exact;
+    }
+
+    /* Counts the foreground pixels in [x0, x1) of a row */
+    static int count ( const uint64_t * row, int x0, int x1 );
+    /* Thresholds n pixels into bits, giving 1 for pixels of at least 0.5. Returns false if any pixel was not 0 or 1 */
+    static bool threshold ( const float * in, int n, uint64_t * out );
+
+private:
+
+    std::vector<uint64_t> bits;
+    int width;
+    int height;
+    int stride;
+    bool exact;
+
+};
+
+class ColumnRuns {
+public:
+
+    /* A run of foreground pixels, from row start up to but not including row end */
+    struct Run {
+        int start;
+        int end;
+    };
+
+    /* Constructors */
+    ColumnRuns ();
+    ColumnRuns ( GrayView v );
+    ColumnRuns ( const BinaryImage & t );
+    /* Destructor */
+    ~ColumnRuns ();
+
+    /* The dimensions of the image */
+    int columns() const {
+        return width;
+    }
+    int rows() const {
+        return height;
+    }
+
+    /* The runs of column x from top to bottom, from begin(x) up to end(x) */
+    const Run * begin ( int x ) const {
+        return runs.data() + offsets[x];
+    }
+    const Run * end ( int x ) const {
+        return runs.data() + offsets[x+1];
+    }
+
+    /* Whether every pixel of the image was exactly 0 or 1 */
+    bool isExact() const {
+        return exact;
+    }
+
+    /* Gets the pixel at (x,y) */
+    bool pixel ( int x, int y ) const;
+    /* Counts the foreground pixels in rows [y0, y1) of column x */
+    int count ( int x, int y0, int y1 ) const;
+    /* Finds the first and last foreground pixels from row y0 down column x, or -1 if there are none */
+    int first ( int x, int y0 ) const;
+    int last ( int x, int y0 ) const;
+    /* Counts the pixels from row y0 down column x that differ from the pixel above them, taking row y0-1 as
+     * background
+     */
+    int transitions ( int x, int y0 ) const;
+
+private:
+
+    /* The runs of all of the columns one after the other, and where the runs of each column start */
+    std::vector<Run> runs;
+    std::vector<int> offsets;
+    int width;
+    int height;
+    bool exact;
+
+    /* Adds the runs of each row of bits as a column */
+    void build ( const BinaryImage & t );
+
+};
+
+#endif // _grayimage_h_
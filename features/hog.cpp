@@ -28,13 +28,17 @@
 
 #include "hog.h"
 #include <iostream>
+#include <string.h>
+#include <algorithm>
 
 /* Constructor
- * Creates a new image so that the original is not overwritten
+ * Keeps a view of the greyscale image. The pixels are only read from, so nothing is copied
  */
-HoG::HoG ( Magick::Image * i ) {
-    image = new Magick::Image();
-    image = i;
+HoG::HoG ( GrayView v ) {
+    image = v;
+    pool = 0;
+    thresholded = 0;
+    cornerCode = 4;
 }
 
 /* Destructor */
@@ -42,6 +46,185 @@ HoG::~HoG() {
 
 }
 
+/* Sets a pool to split the work on this image between. The cells and the blocks are split into bands of rows
+ * which are written to their own part of the output, so the features are the same as when the work is done on one
+ * thread.
+ *
+ * @p the pool, or 0 to do all of the work on the calling thread
+ */
+void HoG::setPool ( ThreadPool * p ) {
+    pool = p;
+}
+
+/* Shares a thresholded copy of the image, so that the image does not need to be thresholded again. It must be
+ * shared before the integral orientation histogram is built
+ *
+ * @b the thresholded image, which must be the same size as the view and outlive this object, or 0
+ */
+void HoG::setBinary ( const BinaryImage * b ) {
+    thresholded = b;
+}
+
+/* Thresholds the image, unless a thresholded copy has been shared. Pixels of at least 0.5 are foreground */
+void HoG::buildBinary() {
+    if ( thresholded == 0 ) {
+        binary = BinaryImage ( image );
+        thresholded = &binary;
+    }
+}
+
+/* Gets a word of a row of a thresholded image, as if the row went on past its end with its last pixel as
+ * pixelColor does
+ *
+ * @row the row
+ * @columns the number of pixels in the row
+ * @w the word
+ */
+static inline uint64_t paddedWord ( const uint64_t * row, int columns, int w ) {
+    int valid = columns - w*64;
+    if ( valid >= 64 ) {
+        return row[w];
+    }
+    uint64_t word = valid > 0 ? row[w] : 0;
+    if ( ( row[( columns-1 ) /64] >> ( ( columns-1 ) %64 ) ) & 1 ) {
+        word |= valid > 0 ? ~0ULL << valid : ~0ULL;
+    }
+    return word;
+}
+
+/* Calculates the gradient code of each pixel in a row of a thresholded image. With dx and dy in {-1,0,1}
+ * the code is 3*(dx+1)+(dy+1), which indexes the lookup table.
+ * The rows are taken 64 pixels at a time. The left and right neighbours of the pixels in a word come from shifting
+ * it by one pixel, with the pixel carried over from the next word, and words where neither neighbour differs from
+ * the other (xor) have no gradient anywhere. Pixels outside the image read the edge pixel.
+ *
+ * @above the row above
+ * @current the row itself
+ * @below the row below
+ * @columns the number of pixels in the rows
+ * @n the number of codes, which may run past the end of the rows
+ * @codes the gradient codes
+ */
+static void gradientCodes ( const uint64_t * above, const uint64_t * current, const uint64_t * below,
+                            int columns, int n, unsigned char * codes ) {
+
+    uint64_t here = paddedWord ( current, columns, 0 );
+    /* The pixel to the left of the first pixel is the first pixel itself */
+    uint64_t carry = here & 1;
+
+    for ( int w = 0; w*64 < n; w++ ) {
+
+        uint64_t next = paddedWord ( current, columns, w+1 );
+        uint64_t left = ( here << 1 ) | carry;
+        uint64_t right = ( here >> 1 ) | ( next << 63 );
+        uint64_t up = paddedWord ( above, columns, w );
+        uint64_t down = paddedWord ( below, columns, w );
+
+        unsigned char * c = codes + w*64;
+        int m = n-w*64 < 64 ? n-w*64 : 64;
+        if ( ( ( left ^ right ) | ( up ^ down ) ) == 0 ) {
+            memset ( c, 4, m );
+        } else {
+            for ( int i = 0; i < m; i++ ) {
+                int dx = ( int ) ( ( right >> i ) & 1 ) - ( int ) ( ( left >> i ) & 1 );
+                int dy = ( int ) ( ( down >> i ) & 1 ) - ( int ) ( ( up >> i ) & 1 );
+                c[i] = 3*dx + dy + 4;
+            }
+        }
+
+        carry = here >> 63;
+        here = next;
+
+    }
+
+}
+
+/* Builds the lookup table which gives the channel of each of the nine possible gradients.
+ * Since the pixels are thresholded dx and dy can only be -1, 0 or 1, so the orientation and channel
+ * only need to be worked out nine times rather than for every pixel.
+ *
+ * @channels - the number of channels to appear in the histogram
+ * @sign - the sign of the orients
+ * @lookup - for each gradient code, the index of its count (channel*2, +1 if diagonal) or -1 if the gradient is
+ * not counted
+ */
+static void buildLookup ( int channels, bool sign, int lookup[9] ) {
+
+    for ( int dx = -1; dx <= 1; dx++ ) {
+        for ( int dy = -1; dy <= 1; dy++ ) {
+
+            int code = 3* ( dx+1 ) + ( dy+1 );
+            lookup[code] = -1;
+
+            /* Zero gradients add nothing to the histogram */
+            if ( dx == 0 && dy == 0 ) {
+                continue;
+            }
+
+            /* The magnitude of the pixel is 1 for axial gradients and sqrt(2) for diagonal ones */
+            int diagonal = ( dx != 0 && dy != 0 ) ? 1 : 0;
+            /* Calculate the orientation of the pixel */
+            double orientation = atan2 ( dy,dx ) *180/PI;
+
+            /* For unsigned gradients, transform gradients to [0;180] range */
+            if ( sign == false ) {
+                if ( ( int ) orientation < 0 ) {
+                    orientation = orientation+180.0;
+                }
+                /* Find the correct channel */
+                for ( int z = 0; z < channels; z++ ) {
+                    if ( ( int ) orientation <= ( ( 180/channels ) * ( z+1 ) ) ) {
+                        lookup[code] = z*2+diagonal;
+                        break;
+                    }
+                }
+            }
+            /* For signed gradients, transform to [0; 360] range */
+            else {
+                if ( ( int ) orientation < 0 ) {
+                    orientation = orientation+360;
+                }
+                /* Find the correct channel */
+                for ( int z = 0; z < channels; z++ ) {
+                    if ( ( int ) orientation <= ( ( 360/channels ) * ( z+1 ) ) ) {
+                        lookup[code] = z*2+diagonal;
+                        break;
+                    }
+                }
+            }
+
+        }
+    }
+
+}
+
+/* Weights the axial and diagonal counts of each channel by the magnitudes of their gradients, which are 1 and
+ * sqrt(2). The axial count of a channel comes before its diagonal count
+ *
+ * @count the counts, indexed by channel*2, +1 if diagonal
+ * @channels - the number of channels to appear in the histogram
+ * @hgram the histogram
+ */
+static void weightCounts ( const int * count, int channels, double * hgram ) {
+
+    for ( int z = 0; z < channels; z++ ) {
+        hgram[z] = 0.0;
+    }
+    for ( int index = 0; index < channels*2; index++ ) {
+        if ( index % 2 == 0 ) {
+            hgram[index/2] += count[index];
+        } else {
+            hgram[index/2] += count[index]*sqrt ( 2.0 );
+        }
+    }
+
+}
+
+/* The plane of the integral orientation histogram that each gradient code is counted in. Code 4 has no gradient */
+static inline int codePlane ( int code ) {
+    return code < 4 ? code : code-1;
+}
+
 /* Gets the Histogram of Oriented Gradients.
  * @grid the size of the grid for normalisation
  * @cellheight the height of the cells
@@ -51,179 +234,502 @@ HoG::~HoG() {
  */
 std::vector<double> HoG::getHistogram ( int grid, int cellheight, int cellwidth, int channels, bool sign ) {
 
-    /* Create the feature vector */
+    /* Un-normalised features are stored one cell after the other */
+    std::vector<double> h;
+    int gridRows;
+    int gridColumns;
+    getCells ( cellheight, cellwidth, channels, sign, h, gridRows, gridColumns );
+
+    /* Normalise feature vector with non-overlapping blocks - only if grid size and cell size allow for it */
     std::vector<double> f;
+    if ( ( image.rows() /cellheight ) %grid == 0 ) {
+        normaliseFeatures ( grid, gridRows, gridColumns, channels, h, f );
+    } else {
+        normaliseFeatures ( 0, gridRows, gridColumns, channels, h, f );
+    }
 
-    /* Un-normalised features are stored in a vector of vectors */
-    std::vector< std::vector<double> > h;
+    /* Return the feature vector */
+    return f;
+
+}
+
+/* Gets the Histogram of Oriented Gradients with overlapping block normalisation, as in Dalal and Triggs.
+ * Each block of g*g cells is normalised on its own and added to the feature vector, so cells appear once
+ * for every block that they are in. Only whole blocks are written, so cells past the last block are left out,
+ * and the layout is the same whether or not the stride is the block size. If the grid of cells is smaller than
+ * a block the cells are not normalised.
+ *
+ * @grid the size of the blocks, in cells
+ * @stride the number of cells between the start of neighbouring blocks
+ * @cellheight the height of the cells
+ * @cellwidth the width of the cells
+ * @channels - the number of channels to appear in the histogram
+ * @sign - the sign of the orients
+ */
+std::vector<double> HoG::getHistogram ( int grid, int stride, int cellheight, int cellwidth, int channels, bool sign ) {
 
-    /* Create a copy of the image so as not to overwrite the original */
-    Magick::Image * copy;
-    copy = new Magick::Image ( *image );
+    /* Un-normalised features are stored one cell after the other */
+    std::vector<double> h;
+    int gridRows;
+    int gridColumns;
+    getCells ( cellheight, cellwidth, channels, sign, h, gridRows, gridColumns );
 
-    /* Create the historgram with the correct amount of channels */
-    std::vector<double> hgram ( channels );
+    /* Normalise the feature vector */
+    std::vector<double> f;
+    if ( grid > 0 && stride > 0 && gridRows >= grid && gridColumns >= grid ) {
+        normaliseBlocks ( grid, stride, gridRows, gridColumns, channels, h, f );
+    } else {
+        normaliseFeatures ( 0, gridRows, gridColumns, channels, h, f );
+    }
 
-    /* Loop through each of the cells */
-    if ( cellheight != 0 ) {
-        for ( unsigned int i = 1; i < image->rows()-1; i+=cellheight ) {
-            for ( unsigned int j = 1; j < image->columns()-1; j+=cellwidth ) {
+    /* Return the feature vector */
+    return f;
 
-                /* Initialise all histogran channels for the current cell */
-                for ( int x = 0; x < channels; x++ ) {
-                    hgram.at ( x ) = 0.0;
-                }
+}
 
-                /* Loop through cell */
-                for ( unsigned int k = i; k < i+cellheight; k++ ) {
-                    for ( unsigned int l = j; l < j+cellwidth; l++ ) {
-
-                        /* Calculate the values of the pixels in the [-1;0;1] sobel operators */
-                        int x1;
-                        int x2;
-                        int y1;
-                        int y2;
-
-                        /* >=0.5 = foreground, <=0.5 = background */
-                        if ( Magick::ColorGray ( image->pixelColor ( l-1,k ) ).shade() >= 0.5 ) {
-                            x1 = 1;
-                        } else {
-                            x1 = 0;
-                        }
-                        if ( Magick::ColorGray ( image->pixelColor ( l+1,k ) ).shade() >= 0.5 ) {
-                            x2 = 1.0;
-                        } else {
-                            x2 = 0.0;
-                        }
-                        if ( Magick::ColorGray ( image->pixelColor ( l,k-1 ) ).shade() >= 0.5 ) {
-                            y1 = 1.0;
-                        } else {
-                            y1 = 0.0;
-                        }
-                        if ( Magick::ColorGray ( image->pixelColor ( l,k+1 ) ).shade() >= 0.5 ) {
-                            y2 = 1.0;
-                        } else {
-                            y2 = 0.0;
-                        }
+/* Gets the un-normalised histograms of the grid of cells.
+ * If the integral orientation histogram has been built, each cell is looked up in it. Otherwise the cells are counted
+ * one row of cells at a time, so only the gradient codes of one row of pixels and the counts of one row of cells are
+ * kept at once, however large the image is. The image is thresholded once and kept, so getting the features again
+ * with other settings only redoes the gradients. Both give the same histograms.
+ *
+ * @cellheight the height of the cells
+ * @cellwidth the width of the cells
+ * @channels - the number of channels to appear in the histogram
+ * @sign - the sign of the orients
+ * @h the histograms, one cell after the other in rows of cells
+ * @gridRows the number of rows of cells
+ * @gridColumns the number of columns of cells
+ */
+void HoG::getCells ( int cellheight, int cellwidth, int channels, bool sign, std::vector<double> & h, int & gridRows, int & gridColumns ) {
+
+    /* Dimensions of the image */
+    int rows = image.rows();
+    int columns = image.columns();
+
+    /* The cells start at the second row and column and cover up to the second last, so the last cells can
+     * run up to one cell past the edge of the image
+     */
+    gridRows = 0;
+    gridColumns = 0;
+    if ( cellheight > 0 && cellwidth > 0 && rows > 2 && columns > 2 ) {
+        gridRows = ( rows-2+cellheight-1 ) /cellheight;
+        gridColumns = ( columns-2+cellwidth-1 ) /cellwidth;
+    }
+    h.resize ( ( size_t ) gridRows*gridColumns*channels );
+    if ( h.empty() ) {
+        return;
+    }
 
-                        /* Calculate the derivatives */
-                        int dx = ( ( -1.0*x1 )
-                                   + ( 1.0*x2 ) );
-                        int dy = ( ( -1.0*y1 )
-                                   + ( 1.0*y2 ) );
-
-                        /* Calculate the magnitude of the pixel */
-                        double mag = abs ( sqrt ( ( pow ( dx,2.0 ) ) + ( pow ( dy,2.0 ) ) ) );
-                        /* Calculate the orientation of the pixel */
-                        double orientation = atan2 ( dy,dx ) *180/PI;
-
-                        /* This is where the historgrams are calculated. For each cell, there is a histogram of magnitudes for each channel */
-
-                        /* For unsigned gradients, transform gradients to [0;180] range */
-                        if ( sign == false ) {
-                            if ( ( int ) orientation < 0 ) {
-                                orientation = orientation+180.0;
-                            }
-                            /* Add the gradient to the correct channel */
-                            for ( int z = 0; z < channels; z++ ) {
-                                if ( ( int ) orientation <= ( ( 180/channels ) * ( z+1 ) ) ) {
-                                    hgram.at ( z ) += mag;
-                                    break;
-                                }
-                            }
+    buildBinary();
+    int lookup[9];
+    buildLookup ( channels, sign, lookup );
+
+    /* Look up each cell in the table, gathering the counts of its gradients into their channels */
+    int cols = gridColumns;
+    if ( !integral.empty() ) {
+        ThreadPool::parallelFor ( pool, 0, gridRows, [&] ( int begin, int end ) {
+            std::vector<int> count ( channels*2 );
+            int counts[8];
+            for ( int i = begin; i < end; i++ ) {
+                for ( int j = 0; j < cols; j++ ) {
+                    countCodes ( 1+j*cellwidth, 1+i*cellheight, cellwidth, cellheight, counts );
+                    std::fill ( count.begin(), count.end(), 0 );
+                    for ( int code = 0; code < 9; code++ ) {
+                        if ( code != 4 && lookup[code] >= 0 ) {
+                            count[lookup[code]] += counts[codePlane ( code )];
                         }
-                        /* For signed gradients, transform to [0; 360] range */
-                        else {
-                            if ( ( int ) orientation < 0 ) {
-                                orientation = orientation+360;
-                            }
-                            /* Add the gradient to the correct channel */
-                            for ( int z = 0; z < channels; z++ ) {
-                                if ( ( int ) orientation <= ( ( 360/channels ) * ( z+1 ) ) ) {
-                                    hgram.at ( z ) += mag;
-                                    break;
-                                }
-                            }
-                        }
-
                     }
-                } //Complete HoG for cell
+                    weightCounts ( &count[0], channels, &h[( ( size_t ) i*cols+j ) *channels] );
+                }
+            }
+        } );
+        return;
+    }
+
+    /* Count each row of cells */
+    ThreadPool::parallelFor ( pool, 0, gridRows, [&] ( int begin, int end ) {
+        std::vector<unsigned char> codes ( 1+cols*cellwidth );
+        std::vector<int> counts ( ( size_t ) cols*channels*2 );
+        for ( int i = begin; i < end; i++ ) {
+            getCellRow ( 1+i*cellheight, cellheight, cellwidth, channels, cols, lookup, &codes[0], &counts[0],
+                         &h[( size_t ) i*cols*channels] );
+        }
+    } );
+
+}
+
+/* Gets the histograms of one row of cells.
+ * The gradient of every pixel in the row is binned with the lookup table, and the axial and diagonal gradients of each
+ * channel are counted separately. Since the pixels are thresholded the magnitudes can only be 1 or sqrt(2), so each
+ * histogram is the axial count plus sqrt(2) times the diagonal count, and empty cells come out as exactly 0.
+ * Rows and columns past the edge of the image read the edge pixels, as pixelColor does.
+ *
+ * @y the first row of the cells
+ * @cellheight the height of the cells
+ * @cellwidth the width of the cells
+ * @channels - the number of channels to appear in the histogram
+ * @gridColumns the number of cells in the row
+ * @lookup the channel (*2, +1 if diagonal) of each gradient code, or -1
+ * @codes room for the gradient codes of a row of pixels
+ * @counts room for the counts of the row of cells
+ * @h the histograms of the cells
+ */
+void HoG::getCellRow ( int y, int cellheight, int cellwidth, int channels, int gridColumns, const int lookup[9],
+                       unsigned char * codes, int * counts, double * h ) const {
+
+    int rows = image.rows();
+    int columns = image.columns();
+    int n = 1+gridColumns*cellwidth;
+    int indices = channels*2;
 
-                /* Push back vector of features for the cell */
-                h.push_back ( hgram );
+    for ( int z = 0; z < gridColumns*indices; z++ ) {
+        counts[z] = 0;
+    }
 
+    for ( int k = y; k < y+cellheight; k++ ) {
+
+        /* Rows needed by the [-1;0;1] operators. Rows past the edge of the image read the edge row */
+        const uint64_t * above = thresholded->row ( k-1 < rows ? k-1 : rows-1 );
+        const uint64_t * current = thresholded->row ( k < rows ? k : rows-1 );
+        const uint64_t * below = thresholded->row ( k+1 < rows ? k+1 : rows-1 );
+        gradientCodes ( above, current, below, columns, n, codes );
+
+        /* Count the gradient of each pixel in its cell and channel */
+        const unsigned char * c = codes+1;
+        for ( int j = 0; j < gridColumns; j++ ) {
+            int * count = counts + j*indices;
+            for ( int l = 0; l < cellwidth; l++ ) {
+                int index = lookup[c[l]];
+                if ( index >= 0 ) {
+                    count[index]++;
+                }
             }
+            c += cellwidth;
         }
-    }//Complete HoG for all cells
 
-    /* Normalise feature vector - only if grid size and cell size allow for it */
-    std::vector< std::vector<double> > nfv;
-    if ((image->rows()/cellheight)%grid == 0){
-      nfv = normaliseFeatures ( grid, h );
-    }else{
-      nfv = normaliseFeatures ( 0, h );
     }
 
-    /* Linearise the feature vector */
-    for ( unsigned int i = 0; i < nfv.size(); i++ ) {
-        for ( int p = 0; p < 9; p++ ) {
-            f.push_back ( nfv.at ( i ).at ( p ) );
+    /* Weight the counts by the magnitudes of axial and diagonal gradients */
+    for ( int j = 0; j < gridColumns; j++ ) {
+        weightCounts ( counts + j*indices, channels, h + j*channels );
+    }
+
+}
+
+/* Builds the integral orientation histogram, so that the histogram of any rectangle can be looked up rather than
+ * counted. This pays off when the same image is asked for several cell sizes, numbers of channels or signs, or for
+ * sliding windows. It is only built once, and is kept until the object is destroyed.
+ *
+ * The table counts each of the eight non-zero gradients rather than the channels, so one table serves every number of
+ * channels and sign. The counts are kept in 16 bits and wrap around, which still gives the exact count of any
+ * rectangle of fewer than 65536 pixels from four lookups. Larger rectangles are looked up in pieces. Even so the
+ * table takes 16 bytes for every pixel, about 190 MB for a 3000x4000 page, so it is not built unless asked for.
+ */
+void HoG::buildIntegral() {
+
+    int rows = image.rows();
+    int columns = image.columns();
+    if ( !integral.empty() || rows == 0 || columns == 0 ) {
+        return;
+    }
+
+    buildBinary();
+    size_t stride = ( size_t ) ( columns+1 ) *8;
+    integral.assign ( stride* ( rows+1 ), 0 );
+    edgeColumn.assign ( ( size_t ) ( rows+1 ) *8, 0 );
+    edgeRow.assign ( ( size_t ) ( columns+1 ) *8, 0 );
+
+    /* The rows below the image all read the last row, and the columns to the right all read the last column. The
+     * gradient code past the end of each row is kept to count the column
+     */
+    const uint64_t * last = thresholded->row ( rows-1 );
+    std::vector<unsigned char> codes ( columns+1 );
+    std::vector<unsigned char> edge ( rows );
+    gradientCodes ( last, last, last, columns, columns+1, &codes[0] );
+    for ( int l = 0; l < columns; l++ ) {
+        for ( int z = 0; z < 8; z++ ) {
+            edgeRow[( size_t ) ( l+1 ) *8+z] = edgeRow[( size_t ) l*8+z];
+        }
+        if ( codes[l] != 4 ) {
+            edgeRow[( size_t ) ( l+1 ) *8+codePlane ( codes[l] )]++;
         }
     }
+    cornerCode = codes[columns];
+
+    /* Count along each row on its own, and then add the rows down in strips of columns. The counts wrap around in
+     * the same way whichever order they are added in
+     */
+    ThreadPool::parallelFor ( pool, 0, rows, [&] ( int begin, int end ) {
+        std::vector<unsigned char> codes ( columns+1 );
+        for ( int k = begin; k < end; k++ ) {
+            const uint64_t * above = thresholded->row ( k == 0 ? 0 : k-1 );
+            const uint64_t * current = thresholded->row ( k );
+            const uint64_t * below = thresholded->row ( k+1 < rows ? k+1 : rows-1 );
+            gradientCodes ( above, current, below, columns, columns+1, &codes[0] );
+            uint16_t r[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+            uint16_t * sums = &integral[( size_t ) ( k+1 ) *stride];
+            for ( int l = 0; l < columns; l++ ) {
+                if ( codes[l] != 4 ) {
+                    r[codePlane ( codes[l] )]++;
+                }
+                std::copy ( r, r+8, sums + ( size_t ) ( l+1 ) *8 );
+            }
+            edge[k] = codes[columns];
+        }
+    } );
+
+    ThreadPool::parallelFor ( pool, 1, columns+1, [&] ( int begin, int end ) {
+        for ( int k = 1; k < rows; k++ ) {
+            const uint16_t * p = &integral[( size_t ) k*stride + ( size_t ) begin*8];
+            uint16_t * q = &integral[( size_t ) ( k+1 ) *stride + ( size_t ) begin*8];
+            for ( size_t z = 0; z < ( size_t ) ( end-begin ) *8; z++ ) {
+                q[z] += p[z];
+            }
+        }
+    } );
 
-    /* Return the feature vector */
-    return f;
+    for ( int k = 0; k < rows; k++ ) {
+        for ( int z = 0; z < 8; z++ ) {
+            edgeColumn[( size_t ) ( k+1 ) *8+z] = edgeColumn[( size_t ) k*8+z];
+        }
+        if ( edge[k] != 4 ) {
+            edgeColumn[( size_t ) ( k+1 ) *8+codePlane ( edge[k] )]++;
+        }
+    }
+
+}
+
+/* Counts each non-zero gradient in a rectangle from the integral orientation histogram. The part of the rectangle
+ * inside the image is looked up in pieces of fewer than 65536 pixels, so that the wrapped counts are exact, and the
+ * parts which run past the bottom and right of the image are counted along the edges. The rectangle is clipped at the
+ * top and left of the image.
+ *
+ * @x the column of the top left corner of the rectangle
+ * @y the row of the top left corner of the rectangle
+ * @w the width of the rectangle
+ * @h the height of the rectangle
+ * @counts the count of each gradient, in the order of codePlane
+ */
+void HoG::countCodes ( int x, int y, int w, int h, int counts[8] ) const {
+
+    int rows = image.rows();
+    int columns = image.columns();
+    for ( int z = 0; z < 8; z++ ) {
+        counts[z] = 0;
+    }
+
+    int x0 = x < 0 ? 0 : x;
+    int y0 = y < 0 ? 0 : y;
+    int x1 = x+w;
+    int y1 = y+h;
+    if ( x0 >= x1 || y0 >= y1 ) {
+        return;
+    }
+
+    /* The part inside the image */
+    int xi = x1 < columns ? x1 : columns;
+    int yi = y1 < rows ? y1 : rows;
+    size_t stride = ( size_t ) ( columns+1 ) *8;
+    if ( x0 < xi && y0 < yi ) {
+        int pw = xi-x0 < 65535 ? xi-x0 : 65535;
+        int ph = 65535/pw;
+        for ( int a = y0; a < yi; a += ph ) {
+            int a1 = a+ph < yi ? a+ph : yi;
+            for ( int b = x0; b < xi; b += pw ) {
+                int b1 = b+pw < xi ? b+pw : xi;
+                const uint16_t * p = &integral[( size_t ) a*stride + ( size_t ) b*8];
+                const uint16_t * q = &integral[( size_t ) a*stride + ( size_t ) b1*8];
+                const uint16_t * r = &integral[( size_t ) a1*stride + ( size_t ) b*8];
+                const uint16_t * t = &integral[( size_t ) a1*stride + ( size_t ) b1*8];
+                for ( int z = 0; z < 8; z++ ) {
+                    counts[z] += ( uint16_t ) ( t[z] - q[z] - r[z] + p[z] );
+                }
+            }
+        }
+    }
+
+    /* The columns to the right of the image, the rows below it and the corner past both */
+    int right = x1 > columns ? x1 - ( x0 > columns ? x0 : columns ) : 0;
+    int bottom = y1 > rows ? y1 - ( y0 > rows ? y0 : rows ) : 0;
+    if ( right > 0 && y0 < yi ) {
+        for ( int z = 0; z < 8; z++ ) {
+            counts[z] += right* ( edgeColumn[( size_t ) yi*8+z] - edgeColumn[( size_t ) y0*8+z] );
+        }
+    }
+    if ( bottom > 0 && x0 < xi ) {
+        for ( int z = 0; z < 8; z++ ) {
+            counts[z] += bottom* ( edgeRow[( size_t ) xi*8+z] - edgeRow[( size_t ) x0*8+z] );
+        }
+    }
+    if ( right > 0 && bottom > 0 && cornerCode != 4 ) {
+        counts[codePlane ( cornerCode )] += right*bottom;
+    }
+
+}
+
+/* Gets the histogram of any rectangle of the image from the integral orientation histogram, which is built if it has
+ * not been already. Pixels past the bottom and right of the image read the edge pixels, as the cells do.
+ *
+ * @x the column of the top left corner of the rectangle
+ * @y the row of the top left corner of the rectangle
+ * @w the width of the rectangle
+ * @h the height of the rectangle
+ * @channels - the number of channels to appear in the histogram
+ * @sign - the sign of the orients
+ * @hgram the histogram, which must have room for the channels
+ */
+void HoG::getCellHistogram ( int x, int y, int w, int h, int channels, bool sign, double * hgram ) {
+
+    buildIntegral();
+    int lookup[9];
+    buildLookup ( channels, sign, lookup );
+    std::vector<int> count ( channels*2 );
+    int counts[8];
+    countCodes ( x, y, w, h, counts );
+    for ( int code = 0; code < 9; code++ ) {
+        if ( code != 4 && lookup[code] >= 0 ) {
+            count[lookup[code]] += counts[codePlane ( code )];
+        }
+    }
+    weightCounts ( &count[0], channels, hgram );
 
 }
 
 /* Normalises the feature vector by performing block normalisation.
- * Does not do overlapping blocks - perhaps later.
- * @g - the grid size, ie. number of cells in grid
- * @in - the vector of feature vectors
+ * The blocks do not overlap and each cell is normalised in place, so the features stay in the order of the cells,
+ * with blocks at the edges of the grid covering whatever cells are left.
+ *
+ * @g - the grid size, ie. number of cells in grid. Set to 0 to prevent normalisation
+ * @gridRows - the number of rows of cells
+ * @gridColumns - the number of columns of cells
+ * @channels - the number of channels in each histogram
+ * @in - the histograms, one cell after the other
+ * @out - the normalised feature vector
  */
 
-std::vector< std::vector<double> > HoG::normaliseFeatures ( int g, std::vector< std::vector<double> > in ) {
+void HoG::normaliseFeatures ( int g, int gridRows, int gridColumns, int channels, const std::vector<double> & in, std::vector<double> & out ) {
 
     /* Can set g to 0 to prevent normalisation */
-    if ( g != 0 ) {
-        /* Loop through the feature vector as if it is a square array */
-        for ( int i = 0; i < sqrt ( in.size() ); i+=g ) {
-            for ( int j = 0; j < sqrt ( in.size() ); j+=g ) {
+    if ( g <= 0 ) {
+        out = in;
+        return;
+    }
 
-                /*Variable for the norm */
-                double v_norm = 0;
+    /* Squared epsilon which stops empty blocks from dividing by zero */
+    double epsilon = pow ( pow ( 10.0, -6 ), 2.0 );
 
-                /* Loop through the cells in the grid */
-                for ( int k = i; k < i+g; k++ ) {
-                    for ( int l = j; l < j+g; l++ ) {
-                        /* Loop through the magnitudes in each histogram channel */
-                        for ( int p = 0; p < 9; p++ ) {
-                            /* Sum the square magnitudes for each channel */
-                            v_norm = v_norm + pow ( in.at ( k*sqrt ( in.size() ) +l ).at ( p ), 2.0 );
+    out.resize ( in.size() );
+
+    ThreadPool::parallelFor ( pool, 0, ( gridRows+g-1 ) /g, [&] ( int begin, int end ) {
+        for ( int bi = begin; bi < end; bi++ ) {
+            int i = bi*g;
+            for ( int j = 0; j < gridColumns; j+=g ) {
+
+                int rowEnd = i+g < gridRows ? i+g : gridRows;
+                int columnEnd = j+g < gridColumns ? j+g : gridColumns;
+
+                /* Sum the square magnitudes for each channel of each cell in the block */
+                double v_norm = 0;
+                for ( int k = i; k < rowEnd; k++ ) {
+                    for ( int l = j; l < columnEnd; l++ ) {
+                        const double * cell = &in[( ( size_t ) k*gridColumns+l ) *channels];
+                        for ( int p = 0; p < channels; p++ ) {
+                            v_norm = v_norm + cell[p]*cell[p];
                         }
                     }
                 }
 
-                /* Get the square root of the norm */
+                /* Get the square root of the norm and the normalising factor */
                 v_norm = sqrt ( v_norm );
+                double f = sqrt ( pow ( v_norm, 2.0 ) + epsilon );
+
+                /* Normalise all features in the block */
+                for ( int k = i; k < rowEnd; k++ ) {
+                    for ( int l = j; l < columnEnd; l++ ) {
+                        size_t offset = ( ( size_t ) k*gridColumns+l ) *channels;
+                        for ( int p = 0; p < channels; p++ ) {
+                            out[offset+p] = in[offset+p] /f;
+                        }
+                    }
+                }
+
+            }
+        }
+    } );
+
+}
+
+/* Normalises the feature vector with blocks of g*g cells that start every stride cells, as in Dalal and Triggs.
+ * Each whole block is normalised on its own and written out in turn, one row of blocks after the other, so cells
+ * appear once for every block that they are in and cells past the last block are left out. The norm of each block
+ * is found from a summed area table of the energy of each cell, so the cost of finding the norms does not grow with
+ * the overlap.
+ *
+ * @g - the block size, in cells
+ * @stride - the number of cells between the start of neighbouring blocks
+ * @gridRows - the number of rows of cells, at least g
+ * @gridColumns - the number of columns of cells, at least g
+ * @channels - the number of channels in each histogram
+ * @in - the histograms, one cell after the other
+ * @out - the normalised blocks
+ */
+void HoG::normaliseBlocks ( int g, int stride, int gridRows, int gridColumns, int channels, const std::vector<double> & in, std::vector<double> & out ) {
+
+    /* Squared epsilon which stops empty blocks from dividing by zero */
+    double epsilon = pow ( pow ( 10.0, -6 ), 2.0 );
+
+    /* Build the summed area table of the cell energies */
+    std::vector<double> energy ( ( size_t ) ( gridRows+1 ) * ( gridColumns+1 ), 0.0 );
+    for ( int k = 0; k < gridRows; k++ ) {
+        double r = 0;
+        for ( int l = 0; l < gridColumns; l++ ) {
+            const double * cell = &in[( ( size_t ) k*gridColumns+l ) *channels];
+            for ( int p = 0; p < channels; p++ ) {
+                r += cell[p]*cell[p];
+            }
+            energy[( size_t ) ( k+1 ) * ( gridColumns+1 ) +l+1] = energy[( size_t ) k* ( gridColumns+1 ) +l+1] + r;
+        }
+    }
+
+    /* Allocate the whole output at once */
+    int blockRows = ( gridRows-g ) /stride+1;
+    int blockColumns = ( gridColumns-g ) /stride+1;
+    size_t blockSize = ( size_t ) g*g*channels;
+    out.resize ( ( size_t ) blockRows*blockColumns*blockSize );
+
+    /* Each row of blocks is written to its own part of the output */
+    ThreadPool::parallelFor ( pool, 0, blockRows, [&] ( int begin, int end ) {
+        for ( int bi = begin; bi < end; bi++ ) {
+            double * o = &out[( size_t ) bi*blockColumns*blockSize];
+            for ( int bj = 0; bj < blockColumns; bj++ ) {
+
+                int i = bi*stride;
+                int j = bj*stride;
+
+                /* Look up the sum of the square magnitudes in the block */
+                size_t top = ( size_t ) i* ( gridColumns+1 );
+                size_t bottom = ( size_t ) ( i+g ) * ( gridColumns+1 );
+                double v_norm = energy[bottom+j+g] - energy[top+j+g] - energy[bottom+j] + energy[top+j];
+                if ( v_norm < 0 ) {
+                    v_norm = 0;
+                }
+
                 /* Get the normalising factor */
-                double f = sqrt ( pow ( v_norm, 2.0 ) + pow ( pow ( 10.0, -6 ), 2.0 ) );
+                double f = sqrt ( v_norm + epsilon );
 
-                /* Loop through all features in the feature vector and normalise */
+                /* Write out the normalised cells of the block */
                 for ( int k = i; k < i+g; k++ ) {
                     for ( int l = j; l < j+g; l++ ) {
-                        for ( int p = 0; p < 9; p++ ) {
-                            in.at ( k*sqrt ( in.size() ) +l ).at ( p ) = in.at ( k*sqrt ( in.size() ) +l ).at ( p ) /f;
+                        const double * cell = &in[( ( size_t ) k*gridColumns+l ) *channels];
+                        for ( int p = 0; p < channels; p++ ) {
+                            *o++ = cell[p] /f;
                         }
-
                     }
                 }
 
             }
         }
-    }
-
-    /* Return the normalised feature vector */
-    return in;
+    } );
 
 }
@@ -30,26 +30,62 @@
 
 #define PI 3.14159265
 
-#include <Magick++.h>
 #include <math.h>
 #include <vector>
+#include "grayimage.h"
+#include "threadpool.h"
 
 class HoG {
 public:
 
     /* Constructor */
-    HoG ( Magick::Image * i );
+    HoG ( GrayView v );
     /* Destructor */
     ~HoG ();
     /* Calculates the features */
     std::vector<double> getHistogram ( int g, int ch, int cw, int c, bool si );
+    /* Calculates the features with overlapping blocks */
+    std::vector<double> getHistogram ( int g, int s, int ch, int cw, int c, bool si );
+    /* Builds the integral orientation histogram, after which cells are looked up in it rather than counted */
+    void buildIntegral();
+    /* Gets the histogram of any rectangle of the image from the integral orientation histogram */
+    void getCellHistogram ( int x, int y, int w, int h, int c, bool si, double * hgram );
+    /* Sets a pool to split the work on this image between. The work is done on the calling thread by default */
+    void setPool ( ThreadPool * p );
+    /* Shares a thresholded copy of the image */
+    void setBinary ( const BinaryImage * b );
 
 
 private:
 
-    Magick::Image * image;
-    /* Normalises the features if requested */
-    std::vector< std::vector<double> > normaliseFeatures ( int g, std::vector< std::vector<double> > in );
+    GrayView image;
+    ThreadPool * pool;
+    const BinaryImage * thresholded;
+
+    /* The thresholded image, which is either shared or made here when it is first needed */
+    BinaryImage binary;
+    /* Thresholds the image if no thresholded copy has been shared */
+    void buildBinary();
+
+    /* The integral orientation histogram, which is only built when asked for. It counts each of the eight non-zero
+     * gradients over the image, modulo 2^16. The rows below the image and the columns to its right, which read the
+     * edge pixels, have the same gradients as each other, so they are counted along the edges instead
+     */
+    std::vector<uint16_t> integral;
+    std::vector<int> edgeRow;
+    std::vector<int> edgeColumn;
+    int cornerCode;
+    /* Counts each non-zero gradient in a rectangle, which may run past the bottom and right of the image */
+    void countCodes ( int x, int y, int w, int h, int counts[8] ) const;
+
+    /* Gets the histograms of the grid of cells */
+    void getCells ( int ch, int cw, int c, bool si, std::vector<double> & h, int & gridRows, int & gridColumns );
+    /* Gets the histograms of one row of cells */
+    void getCellRow ( int y, int ch, int cw, int c, int gridColumns, const int lookup[9], unsigned char * codes, int * counts, double * h ) const;
+    /* Normalises the features in place with non-overlapping blocks, if requested */
+    void normaliseFeatures ( int g, int gridRows, int gridColumns, int c, const std::vector<double> & in, std::vector<double> & out );
+    /* Normalises the features with blocks at a stride, writing out each block in turn */
+    void normaliseBlocks ( int g, int s, int gridRows, int gridColumns, int c, const std::vector<double> & in, std::vector<double> & out );
 
 };
 
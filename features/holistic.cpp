@@ -23,13 +23,35 @@
  */
 
 #include "holistic.h"
+#include <stdexcept>
 
 /* Constructor
- * Creates a new image so that the original is not overwritten
+ * Keeps a view of the greyscale image. The pixels are only read from, so nothing is copied
  */
-Holistic::Holistic ( Magick::Image * i ) {
-    image = new Magick::Image();
-    image = i;
+Holistic::Holistic ( GrayView v ) {
+    image = v;
+    height = v.rows();
+    frames = 0;
+    frame = 0;
+    shared = false;
+    runs = 0;
+    sharedRuns = false;
+}
+
+/* Constructor for streaming. The columns of the image are pushed in strips from left to right, and the features of
+ * each column are passed to the sink as a frame as soon as the column is pushed, in the same order as
+ * Features::getHolistic gives them. Nothing is kept between strips.
+ *
+ * @rows the height of the image
+ * @sink where the frames are sent
+ */
+Holistic::Holistic ( int rows, FrameSink * sink ) {
+    height = rows;
+    frames = sink;
+    frame = 0;
+    shared = false;
+    runs = 0;
+    sharedRuns = false;
 }
 
 /* Destructor */
@@ -37,6 +59,66 @@ Holistic::~Holistic() {
 
 }
 
+/* Gets all of the holistic features in one pass over the image. The image is transposed so that each column is
+ * contiguous, and the six features of each column are found in one walk down it. The features are interleaved by
+ * column as projection profile, upper and lower half projection profiles, upper and lower profile and transitions.
+ */
+std::vector<int> Holistic::getHolistic() {
+
+    std::vector<int> f ( ( size_t ) image.columns() *FEATURES );
+    if ( image.rows() == 0 ) {
+        return f;
+    }
+
+    /* For a binary image the features come from the runs of each column, if they have been shared */
+    if ( sharedRuns == true && runs->isExact() ) {
+        for ( int i = 0; i < runs->columns(); i++ ) {
+            getColumn ( i, &f[( size_t ) i*FEATURES] );
+        }
+        return f;
+    }
+
+    GrayImage columns;
+    GrayView t = transposed;
+    if ( shared == false ) {
+        columns = GrayImage::transpose ( image );
+        t = columns.view();
+    }
+    for ( int i = 0; i < t.rows(); i++ ) {
+        getColumn ( t.row ( i ), &f[( size_t ) i*FEATURES] );
+    }
+
+    return f;
+
+}
+
+/* Shares a transposed copy of the image, so that getHolistic does not need to transpose the image again
+ *
+ * @t the image with rows and columns swapped, as given by GrayImage::transpose
+ */
+void Holistic::setTransposed ( GrayView t ) {
+    transposed = t;
+    shared = true;
+}
+
+/* Shares the runs of foreground in each column. If every pixel of the image is 0 or 1 the runs hold the pixels
+ * themselves, and getHolistic takes the features from them instead of walking the pixels
+ *
+ * @r the runs, which must be for the same image and outlive this object, or 0
+ */
+void Holistic::setRuns ( const ColumnRuns * r ) {
+    runs = r;
+    sharedRuns = r != 0;
+}
+
+/* Finds the runs of foreground in each column of the image, unless they have been shared */
+void Holistic::buildRuns() {
+    if ( runs == 0 ) {
+        columnRuns = ColumnRuns ( image );
+        runs = &columnRuns;
+    }
+}
+
 /* Gets the projection profile features
  * @start the rows to start at
  * @end the row to end at
@@ -46,10 +128,10 @@ std::vector<int> Holistic::getProjectionProfile ( int start, int end ) {
     /* Vector for storing projection profiles */
     std::vector<int> pp;
     /* Loop through all of the columns and get the projection profile */
-    for ( unsigned int i = 0; i < image->columns(); i++ ) {
+    for ( int i = 0; i < image.columns(); i++ ) {
         int col = 0;
         for ( int j = start; j < end; j++ ) {
-            col += Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
+            col += image.row ( j ) [i];
         }
         pp.push_back ( col );
     }
@@ -57,50 +139,41 @@ std::vector<int> Holistic::getProjectionProfile ( int start, int end ) {
     return pp;
 }
 
-/* Gets the profile of the image
+/* Gets the profile of the image. The upper profile is the start of the first run of each column, and the lower
+ * profile is the end of the last run
  * @bottom whether we're starting at the bottom or not for upper or lower profile
  */
 
 std::vector<int> Holistic::getProfile ( bool bottom ) {
     std::vector<int> p;
+    buildRuns();
     /* Loop through all the columsn of the image */
-    for ( unsigned int i = 0; i < image->columns(); i++ ) {
-        int col = 0;
-        /* The upper profile */
-        if ( bottom == false ) {
-            for ( unsigned int j = 0; j < image->rows(); j++ ) {
-                if ( Magick::ColorGray ( image->pixelColor ( i,j ) ).shade() >= 0.5 ) {
-                    col = j;
-                    break;
-                }
-            }
-        }
-        /* The lower profile */
-        else if ( bottom == true ) {
-            for ( unsigned int j = image->rows(); j > 0; j-- ) {
-                if ( Magick::ColorGray ( image->pixelColor ( i,j ) ).shade() >= 0.5 ) {
-                    col = j;
-                    break;
-                }
-            }
-        }
+    for ( int i = 0; i < image.columns(); i++ ) {
+        int col = bottom ? runs->last ( i, 0 ) : runs->first ( i, 0 );
         // Add column feature to vector */
-        p.push_back ( col );
+        p.push_back ( col < 0 ? 0 : col );
     }
     /* Return feature vector */
     return p;
 }
 
-/* Gets the number of foreground-background transitions in each column */
+/* Gets the number of foreground-background transitions in each column. For a binary image each run of a column
+ * starts and ends with a transition, so they are counted from the runs
+ */
 std::vector<int> Holistic::getTransitions() {
     std::vector<int> t;
+    buildRuns();
     /* Loop through the columns */
-    for ( unsigned int i = 0; i < image->columns(); i++ ) {
+    for ( int i = 0; i < image.columns(); i++ ) {
+        if ( runs->isExact() ) {
+            t.push_back ( runs->transitions ( i, 0 ) );
+            continue;
+        }
         double last = 0;
         int transitions = 0;
         /* For each row count the transitions */
-        for ( unsigned int j = 0; j < image->rows(); j++ ) {
-            double cur = Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
+        for ( int j = 0; j < image.rows(); j++ ) {
+            double cur = image.row ( j ) [i];
             if ( cur != last ) {
                 transitions++;
             }
@@ -112,3 +185,119 @@ std::vector<int> Holistic::getTransitions() {
     /* Return the feature vector */
     return t;
 }
+
+/* Pushes the next strip of columns. The strip is transposed so that each column can be walked through contiguous
+ * memory.
+ *
+ * @strip the columns, which must be as high as the image
+ */
+void Holistic::push ( GrayView strip ) {
+
+    if ( strip.rows() != height ) {
+        throw std::invalid_argument ( "Holistic: a pushed strip is not as high as the image" );
+    }
+    if ( height == 0 ) {
+        return;
+    }
+
+    GrayImage columns = GrayImage::transpose ( strip );
+    GrayView t = columns.view();
+    int values[FEATURES];
+    double features[FEATURES];
+    for ( int i = 0; i < t.rows(); i++ ) {
+        getColumn ( t.row ( i ), values );
+        for ( int k = 0; k < FEATURES; k++ ) {
+            features[k] = values[k];
+        }
+        if ( frames != 0 ) {
+            frames->putFrame ( frame, features, FEATURES );
+        }
+        frame++;
+    }
+
+}
+
+/* Calculates the features of one column in a single walk down it: the projection profiles of the whole column and
+ * of its top and bottom halves, the upper and lower profiles and the number of transitions. The values are the
+ * same as those of the whole image methods.
+ *
+ * @column the pixels of the column
+ * @features where the six features are written
+ */
+void Holistic::getColumn ( const float * column, int * features ) {
+
+    int rows = height;
+    int half = rows/2;
+
+    /* Projection profiles, which are summed into integers as getProjectionProfile does */
+    int pp = 0;
+    int upp = 0;
+    int lpp = 0;
+
+    /* The first and last foreground pixels, which give the upper and lower profiles */
+    int up = -1;
+    int lp = 0;
+
+    int transitions = 0;
+    double last = 0;
+
+    for ( int j = 0; j < rows; j++ ) {
+
+        float p = column[j];
+
+        pp += p;
+        if ( j < half ) {
+            upp += p;
+        } else {
+            lpp += p;
+        }
+
+        if ( p >= 0.5 ) {
+            if ( up < 0 ) {
+                up = j;
+            }
+            lp = j;
+        }
+
+        double cur = p;
+        if ( cur != last ) {
+            transitions++;
+        }
+        last = cur;
+
+    }
+
+    features[0] = pp;
+    features[1] = upp;
+    features[2] = lpp;
+    features[3] = up < 0 ? 0 : up;
+    features[4] = lp;
+    features[5] = transitions;
+
+}
+
+/* Calculates the features of one column of a binary image from its runs. The projection profiles are the lengths
+ * of the runs in each half, the profiles are the ends of the first and last runs, and each run starts and ends with
+ * a transition. Since the pixels are 0 or 1 the values are the same as those from the pixels.
+ *
+ * @x the column
+ * @features where the six features are written
+ */
+void Holistic::getColumn ( int x, int * features ) {
+
+    int rows = height;
+    int half = rows/2;
+
+    int upp = runs->count ( x, 0, half );
+    int lpp = runs->count ( x, half, rows );
+    int up = runs->first ( x, 0 );
+    int lp = runs->last ( x, 0 );
+
+    features[0] = upp + lpp;
+    features[1] = upp;
+    features[2] = lpp;
+    features[3] = up < 0 ? 0 : up;
+    features[4] = lp < 0 ? 0 : lp;
+    features[5] = runs->transitions ( x, 0 );
+
+}
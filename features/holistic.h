@@ -25,24 +25,58 @@
 #ifndef _holistic_h_
 #define _holistic_h_
 
-#include <Magick++.h>
 #include <math.h>
 #include <vector>
+#include "grayimage.h"
+#include "framesink.h"
 
 class Holistic {
 public:
 
     /* Constructor */
-    Holistic ( Magick::Image * i );
+    Holistic ( GrayView v );
+    /* Constructor for streaming the features of an image which is pushed a strip of columns at a time */
+    Holistic ( int rows, FrameSink * sink );
     ~Holistic ();
+    /* Gets all of the features, interleaved by column */
+    std::vector<int> getHolistic();
+    /* Shares a transposed copy of the image */
+    void setTransposed ( GrayView t );
+    /* Shares the runs of foreground in each column */
+    void setRuns ( const ColumnRuns * r );
     /* Gets the different features */
     std::vector<int> getProjectionProfile ( int start, int end );
     std::vector<int> getProfile ( bool bottom );
     std::vector<int> getTransitions();
 
+    /* Pushes the next strip of columns of a streamed image. Throws if it is not as high as the image */
+    void push ( GrayView strip );
+
+    /* The number of features for each column when streaming */
+    static const int FEATURES = 6;
+
 private:
 
-    Magick::Image * image;
+    GrayView image;
+    /* The image with rows and columns swapped, if it has been shared */
+    GrayView transposed;
+    bool shared;
+    /* The runs of foreground in each column, which are either shared or made here when they are first needed */
+    const ColumnRuns * runs;
+    bool sharedRuns;
+    ColumnRuns columnRuns;
+    /* Finds the runs if they have not been shared */
+    void buildRuns();
+
+    /* The height of a streamed image, where its frames go and the number of the next frame */
+    int height;
+    FrameSink * frames;
+    long frame;
+
+    /* Calculates all of the features of one column */
+    void getColumn ( const float * column, int * features );
+    /* Calculates all of the features of column x from its runs */
+    void getColumn ( int x, int * features );
 
 };
 
@@ -32,11 +32,32 @@
 
 #include "martibunke.h"
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 /* Constructor */
-MartiBunke::MartiBunke ( Magick::Image* i ) {
-    image = new Magick::Image();
-    image = i;
+MartiBunke::MartiBunke ( GrayView v ) {
+    image = v;
+    shared = false;
+    runs = 0;
+    binary = false;
+    start ( v.rows(), 1, 1, 0 );
+}
+
+/* Constructor for streaming. The columns of the image are pushed in strips from left to right, and each frame is
+ * passed to the sink as soon as the columns it needs have been pushed. Only the last w+1 columns are kept, so the
+ * memory used depends on the window and not on the length of the image.
+ *
+ * @rows the height of the image
+ * @w the width of the window
+ * @s the shift of the window between frames
+ * @sink where the frames are sent
+ */
+MartiBunke::MartiBunke ( int rows, int w, int s, FrameSink * sink ) {
+    shared = false;
+    runs = 0;
+    binary = false;
+    start ( rows, w, s, sink );
 }
 
 /* Destructor */
@@ -44,237 +65,411 @@ MartiBunke::~MartiBunke() {
 
 }
 
-/* Method to calculate the Marti & Bunke features */
+/* Sets up an empty window, with a ring of pixels unless the columns are read from the runs
+ *
+ * @rows the height of the image
+ * @w the width of the window
+ * @s the shift of the window between frames
+ * @sink where the frames are sent
+ */
+void MartiBunke::start ( int rows, int w, int s, FrameSink * sink ) {
+    height = rows;
+    width = w;
+    shift = s;
+    frames = sink;
+    if ( binary == true ) {
+        ring.clear();
+    } else {
+        ring.assign ( ( size_t ) ( w+1 ) *rows, 0.0f );
+    }
+    received = 0;
+    frame = 0;
+    resetWindow();
+}
+
+/* Method to calculate the Marti & Bunke features with a window one column wide */
 std::vector<double> MartiBunke::getMartiBunke() {
+    return getMartiBunke ( 1, 1 );
+}
+
+/* Method to calculate the Marti & Bunke features with a sliding window.
+ *
+ * Rather than summing the w columns of every frame, the window keeps running sums for each row and the contours
+ * of its columns, and only the columns which enter and leave it are walked as it slides. So a frame costs about
+ * the same however wide the window is.
+ *
+ * A frame is taken at every s columns for as long as there is a column to the right of the window, which the
+ * contour gradients need. With w = 1 and s = 1 the features are the same as the original column features.
+ *
+ * @w the width of the window
+ * @s the shift of the window between frames
+ */
+std::vector<double> MartiBunke::getMartiBunke ( int w, int s ) {
 
     /* Feature vector */
     std::vector<double> f;
+    if ( w < 1 || s < 1 || image.columns() < w+1 ) {
+        return f;
+    }
+    f.reserve ( ( size_t ) ( ( image.columns()-1-w ) /s + 1 ) *FEATURES );
 
-    /* Feature variables */
-    f1 = 0;
-    f2 = 0;
-    f3 = 0;
-    f4 = 0;
-    f5 = 0;
-    f6 = 0;
-    f7 = 0;
-    f8 = 0;
-    f9 = 0;
-    int offset = 0;
-
-    /* Loops through each column of the window since features are extracted using a sliding window */
-    for ( unsigned int i = 0; i < image->columns()-1; i++ ) {
-
-        /* Create a copy of the image to store the current column */
-        column = new Magick::Image ( *image );
-
-        /* Crop the image so that it is one column wide */
-        column->page(Magick::Geometry(1,column->rows(),0,0));
-        column->crop(Magick::Geometry(1,column->rows(),offset,0));
-
-        /* Get all of the features */
-        f1 = getF1();
-        f2 = getF2();
-        f3 = getF3();
-        f4 = getF4();
-        f5 = getF5();
-        f6 = getF6((int)f4, i);
-        f7 = getF7((int)f5, i);
-        f8 = getF8();
-        f9 = getF9((int)f4, (int)f5);
-
-        /* Add the features to the feature vector */
-        f.push_back(f1);
-        f.push_back(f2);
-        f.push_back(f3);
-        f.push_back(f4);
-        f.push_back(f5);
-        f.push_back(f6);
-        f.push_back(f7);
-        f.push_back(f8);
-        f.push_back(f9);
-
-        /* Increase the offset for the next column segmentation */
-        offset++;
-
-
+    /* The whole image is pushed as one strip, with the frames collected into the feature vector. If the image has
+     * been transposed already its columns are taken straight from the copy, and if it is binary they are read from
+     * the runs
+     */
+    FrameVector sink ( f );
+    binary = runs != 0 && runs->isExact() && image.rows() > 0;
+    start ( image.rows(), w, s, &sink );
+    if ( binary == true ) {
+        for ( int i = 0; i < runs->columns(); i++ ) {
+            putColumn();
+        }
+    } else if ( shared == true ) {
+        for ( int i = 0; i < transposed.rows(); i++ ) {
+            putColumn ( transposed.row ( i ) );
+        }
+    } else {
+        push ( image );
     }
+    frames = 0;
 
-    /* Delete the column pointer and return the feature column */
-    delete column;
+    /* Return the feature vector */
     return f;
 
 }
 
-/* Calculates the F1 feature.
- * F1 feature is the weight of the window
+/* Shares a transposed copy of the image, so that getMartiBunke does not need to transpose the image again
+ *
+ * @t the image with rows and columns swapped, as given by GrayImage::transpose
  */
-double MartiBunke::getF1() {
+void MartiBunke::setTransposed ( GrayView t ) {
+    transposed = t;
+    shared = true;
+}
 
-    double f1_t = 0;
+/* Shares the runs of foreground in each column. If every pixel of the image is 0 or 1 the runs hold the pixels
+ * themselves, and getMartiBunke reads the weights, contours and transitions of each column from its runs
+ *
+ * @r the runs, which must be for the same image and outlive this object, or 0
+ */
+void MartiBunke::setRuns ( const ColumnRuns * r ) {
+    runs = r;
+}
 
-    /* Loop through the column image and sum of the pixels */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        f1_t = f1_t + Magick::ColorGray(column->pixelColor(0,i)).shade();
-    }
+/* Pushes the next strip of columns. The strip is transposed so that each column can be walked through contiguous
+ * memory, and the columns are then taken one at a time.
+ *
+ * @strip the columns, which must be as high as the image
+ */
+void MartiBunke::push ( GrayView strip ) {
 
-    /* Get the weight by dividing by total pixels in column window */
-    f1_t = f1_t/column->rows();
+    if ( strip.rows() != height ) {
+        throw std::invalid_argument ( "MartiBunke: a pushed strip is not as high as the image" );
+    }
+    if ( width < 1 || shift < 1 || binary == true ) {
+        return;
+    }
 
-    /* Return the feature */
-    return f1_t;
+    GrayImage columns = GrayImage::transpose ( strip );
+    GrayView t = columns.view();
+    for ( int i = 0; i < t.rows(); i++ ) {
+        putColumn ( t.row ( i ) );
+    }
 
 }
 
-/* Calculates the F2 feature.
- * F2 feature is the center of gravity of the window
+/* Takes the next column of the image as pixels. Columns before the next frame are skipped
+ *
+ * @column the pixels of the column
  */
-double MartiBunke::getF2() {
-
-    double f2_t = 0;
+void MartiBunke::putColumn ( const float * column ) {
 
-    /* Loop through the column image and sum of the product of the pixels and the current row */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        f2_t = f2_t + (i*Magick::ColorGray(column->pixelColor(0,i)).shade());
+    int c = received++;
+    if ( c < ( int ) frame*shift ) {
+        return;
     }
+    std::copy ( column, column+height, &ring[( size_t ) ( c% ( width+1 ) ) *height] );
+    takeColumn ( c );
 
-    /* Divide by the total pixels in the column window */
-    f2_t = f2_t/column->rows();
+}
+
+/* Takes the next column of the image from the runs, which are read where they are. Columns before the next frame
+ * are skipped
+ */
+void MartiBunke::putColumn() {
 
-    /* Return the feature */
-    return f2_t;
+    int c = received++;
+    if ( c < ( int ) frame*shift ) {
+        return;
+    }
+    takeColumn ( c );
 
 }
 
-/* Calculates the F3 feature.
- * F3 feature is the second order moment of the window
+/* Takes column c, which is in the ring or the runs. The next frame covers columns [x, x+w) and also needs column x+w
+ * for the gradients. Columns of the window are added to it as they arrive, and the frame is made when column x+w
+ * arrives. The window then slides on by dropping the columns that the next frame does not cover, or starts over if
+ * the shift is larger than the window.
+ *
+ * @c the column
  */
-double MartiBunke::getF3() {
-
-    double f3_t = 0;
+void MartiBunke::takeColumn ( int c ) {
 
-    /* Loop through the column image and sum the product of the pixels and squared row */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        f3_t = f3_t + (pow(i,2.0)*Magick::ColorGray(column->pixelColor(0,i)).shade());
+    int x = ( int ) frame*shift;
+    if ( c < x+width ) {
+        addColumn ( c );
+        return;
     }
 
-    /* Divide by the squared total pixels in the window */
-    f3_t = f3_t/(pow(column->rows(),2.0));
+    /* Column x+w has arrived, so the frame can be made */
+    double features[FEATURES];
+    getFrame ( x, c, features );
+    if ( frames != 0 ) {
+        frames->putFrame ( frame, features, FEATURES );
+    }
+    frame++;
+
+    /* Slide the window to the next frame. Column x+w is in the next window if the shift is not larger than it */
+    int next = x+shift;
+    if ( next >= c ) {
+        resetWindow();
+    } else {
+        for ( int l = x; l < next; l++ ) {
+            removeColumn ( l );
+        }
+    }
+    if ( next <= c ) {
+        addColumn ( c );
+    }
 
-    /* Return the feature */
-    return f3_t;
+}
 
+/* Clears the window */
+void MartiBunke::resetWindow() {
+    sums.assign ( binary ? 0 : height, 0.0 );
+    uppers.clear();
+    lowers.clear();
+    transitions = 0;
+    ink = 0;
+    inkRows = 0;
+    inkSquares = 0;
 }
 
-/* Calculates the F4 feature.
- * F4 feature is the upper position of the contour of the window
+/* Adds a column to the right of the window. The row sums are updated and the contours and the transitions of the
+ * column are found in the same walk down it. As in the original features, the first row is skipped.
+ *
+ * For a binary image the contours are the ends of the first and last runs of the column, each run starts and ends
+ * with a transition, and the totals are summed over the runs.
+ *
+ * The contours are kept in monotonic queues, so that the highest upper contour and lowest lower contour of the
+ * window are always at the front.
+ *
+ * @c the column
  */
-double MartiBunke::getF4() {
-
-    /* Assume the upper contour is at the bottom */
-    double f4_t = column->rows();
-    /* Loop through the pixels and if a foreground pixel is found, change the upper contour and break */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        if (Magick::ColorGray(column->pixelColor(0,i)).shade() >= 0.5) {
-            f4_t = i;
-            break;
+void MartiBunke::addColumn ( int c ) {
+
+    int rows = height;
+    int upper = rows;
+    int lower = 0;
+
+    if ( binary == true ) {
+
+        int first = runs->first ( c, 1 );
+        if ( first >= 0 ) {
+            upper = first;
+            lower = runs->last ( c, 1 );
         }
-    }
+        transitions += runs->transitions ( c, 1 );
+        sumColumn ( c, 1 );
 
-    /* Return the upper contour */
-    return f4_t;
+    } else {
 
-}
+        const float * column = &ring[( size_t ) ( c% ( width+1 ) ) *rows];
+        double last = 0.0;
+        for ( int i = 1; i < rows; i++ ) {
+
+            float p = column[i];
+            sums[i] = sums[i] + p;
+
+            /* Track the contours */
+            if ( p >= 0.5 ) {
+                if ( upper == rows ) {
+                    upper = i;
+                }
+                lower = i;
+            }
+
+            /* Count a change in pixel colour and update the last pixel colour seen */
+            if ( p != last ) {
+                transitions++;
+                last = p;
+            }
 
-/* Calculates the F5 feature.
- * F5 feature is the lower position of the contour of the window
- */
-double MartiBunke::getF5() {
-
-    /* Assume the upper contour is at the bottom */
-    double f5_t = 0;
-    /* Loop through the pixels and if a foreground pixel is found, change the lower contour */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        if (Magick::ColorGray(column->pixelColor(0,i)).shade() >= 0.5) {
-            f5_t = i;
         }
+
     }
 
-    /* Return the lower contour */
-    return f5_t;
+    while ( !uppers.empty() && uppers.back().second >= upper ) {
+        uppers.pop_back();
+    }
+    uppers.push_back ( std::make_pair ( c, upper ) );
+    while ( !lowers.empty() && lowers.back().second <= lower ) {
+        lowers.pop_back();
+    }
+    lowers.push_back ( std::make_pair ( c, lower ) );
 
 }
 
-/* Calculates the F6 feature.
- * F6 feature is the gradient of the upper contour of the window
+/* Removes the column on the left of the window
+ *
+ * @c the column
  */
-double MartiBunke::getF6(int f4f, int c) {
+void MartiBunke::removeColumn ( int c ) {
 
-    /* Calculate the gradient based on: d/dx = p(i+1,j)-p(i,j) */
-    double f6_t = Magick::ColorGray(image->pixelColor(c+1,f4f)).shade() - Magick::ColorGray(image->pixelColor(c,f4f)).shade();
+    int rows = height;
 
-    /* Return the gradient */
-    return f6_t;
+    if ( binary == true ) {
 
-}
+        transitions -= runs->transitions ( c, 1 );
+        sumColumn ( c, -1 );
 
-/* Calculates the F7 feature.
- * F7 feature is the gradient of the lower contour of the window
- */
-double MartiBunke::getF7(int f5f, int c) {
+    } else {
 
-    /* Calculate the gradient based on: d/dx = p(i+1,j)-p(i,j) */
-    double f7_t = Magick::ColorGray(image->pixelColor(c+1,f5f)).shade() - Magick::ColorGray(image->pixelColor(c,f5f)).shade();
+        const float * column = &ring[( size_t ) ( c% ( width+1 ) ) *rows];
+        double last = 0.0;
+        for ( int i = 1; i < rows; i++ ) {
+            float p = column[i];
+            sums[i] = sums[i] - p;
+            if ( p != last ) {
+                transitions--;
+                last = p;
+            }
+        }
 
-    /* Return the gradient */
-    return f7_t;
+    }
+
+    if ( !uppers.empty() && uppers.front().first == c ) {
+        uppers.pop_front();
+    }
+    if ( !lowers.empty() && lowers.front().first == c ) {
+        lowers.pop_front();
+    }
 
 }
 
-/* Calculates the F8 feature.
- * F8 feature is the number of background-foreground transitions
+/* Adds the foreground pixels of a column to the totals of the window, or takes them away. The sums of the rows and
+ * of their squares over each run have closed forms, and as in the original features the first row is skipped. The
+ * totals are whole numbers, so they are the same as the sums over the rows
+ *
+ * @c the column
+ * @sign 1 to add the column or -1 to take it away
  */
-double MartiBunke::getF8() {
+void MartiBunke::sumColumn ( int c, int sign ) {
 
-    double f8_t = 0;
-    /* Assume starting with a background pixel */
-    double last = 0.0;
-    /* Loop through the column and if a chnage in pixel colour occurs,
-     * increase the count and update the last pixel colour seen
-     */
-    for (unsigned int i = 1; i < column->rows(); i++) {
-        if (Magick::ColorGray(column->pixelColor(0,i)).shade() != last) {
-            f8_t++;
-            last = Magick::ColorGray(column->pixelColor(0,i)).shade();
+    for ( const ColumnRuns::Run * r = runs->begin ( c ); r != runs->end ( c ); r++ ) {
+        long long a = r->start > 1 ? r->start : 1;
+        long long b = r->end;
+        if ( a >= b ) {
+            continue;
         }
+        /* Sums over rows [a, b) as differences of the sums over rows [0, b) and [0, a) */
+        long long n = b-a;
+        long long rowSum = ( b* ( b-1 ) - a* ( a-1 ) ) /2;
+        long long squareSum = ( ( b-1 ) *b* ( 2*b-1 ) - ( a-1 ) *a* ( 2*a-1 ) ) /6;
+        ink = ink + sign* ( double ) n;
+        inkRows = inkRows + sign* ( double ) rowSum;
+        inkSquares = inkSquares + sign* ( double ) squareSum;
     }
 
-    /* Return the number of foreground-background transitions */
-    return f8_t;
-
 }
 
-/* Calculates the F9 feature.
- * F9 feature is the number of foreground pixels in between the upper and lower contour divided
- * by the height of the contour.
+/* Calculates the features of the window. The features of a window w columns wide are averaged over its columns:
+ *
+ * F1 is the weight of the window.
+ * F2 is the center of gravity of the window.
+ * F3 is the second order moment of the window.
+ * F4 is the upper position of the contour of the window, or the height of the window if there is no foreground.
+ * F5 is the lower position of the contour of the window, or 0 if there is no foreground.
+ * F6 is the gradient of the upper contour of the window, based on: d/dx = (p(i+w,j)-p(i,j))/w.
+ * F7 is the gradient of the lower contour of the window.
+ * F8 is the number of background-foreground transitions, starting from a background pixel.
+ * F9 is the number of foreground pixels in between the upper and lower contour divided by the height of the contour.
+ *
+ * For a binary image F1 to F3 come from the totals, and F9 from the overlap of the runs with the contours.
+ *
+ * @x the first column of the window
+ * @c the column to the right of the window
+ * @features where the nine features are written
  */
-double MartiBunke::getF9(int f4f, int f5f) {
+void MartiBunke::getFrame ( int x, int c, double * features ) {
 
-    double f9_t = 0;
-    /* If the upper and lower contour are the same, assume no pixels between */
-    if (f4f == f5f) {
-        f9_t = 0;
-    }
-    else {
-        /* Loop through the pixels in the upper and lower contour and sum the pixels */
-        for (int i = f4f; i < f5f; i++) {
-            f9_t = f9_t + Magick::ColorGray(column->pixelColor(0,i)).shade();
+    int rows = height;
+    int w = width;
+    int upper = uppers.front().second;
+    int lower = lowers.front().second;
+
+    double weight = 0;
+    double centre = 0;
+    double moment = 0;
+    double contour = 0;
+
+    /* The gradients are taken against the column after the window. Contours outside the image are clamped to the last
+     * row
+     */
+    int u = upper < rows ? upper : rows-1;
+    int l = lower < rows ? lower : rows-1;
+    float f6;
+    float f7;
+
+    if ( binary == true ) {
+
+        weight = ink;
+        centre = inkRows;
+        moment = inkSquares;
+        for ( int k = x; k < x+w && upper < lower; k++ ) {
+            contour = contour + runs->count ( k, upper, lower );
+        }
+
+        f6 = ( float ) runs->pixel ( c, u ) - ( float ) runs->pixel ( x, u );
+        f7 = ( float ) runs->pixel ( c, l ) - ( float ) runs->pixel ( x, l );
+
+    } else {
+
+        for ( int i = 1; i < rows; i++ ) {
+            double p = sums[i];
+            weight = weight + p;
+            centre = centre + ( i*p );
+            moment = moment + ( ( ( double ) i*i ) *p );
+            if ( i >= upper && i < lower ) {
+                contour = contour + p;
+            }
         }
-        /* Divide pixel count by height of contour */
-        f9_t = f9_t/(f5f-f4f);
+
+        const float * first = &ring[( size_t ) ( x% ( w+1 ) ) *rows];
+        const float * next = &ring[( size_t ) ( c% ( w+1 ) ) *rows];
+        f6 = next[u] - first[u];
+        f7 = next[l] - first[l];
+
     }
 
-    /* Return the feature */
-    return f9_t;
+    features[0] = weight/ ( ( double ) rows*w );
+    features[1] = centre/ ( ( double ) rows*w );
+    features[2] = moment/ ( ( double ) rows*rows*w );
+    features[3] = upper;
+    features[4] = lower;
+    features[5] = f6/ ( double ) w;
+    features[6] = f7/ ( double ) w;
+
+    features[7] = transitions/ ( double ) w;
+
+    /* If the upper and lower contour are the same, assume no pixels between */
+    if ( upper == lower ) {
+        features[8] = 0;
+    } else if ( upper > lower ) {
+        /* No foreground. This is an empty sum over a negative height, which gives -0 as it always has */
+        features[8] = 0.0/ ( lower-upper );
+    } else {
+        features[8] = contour/ ( ( double ) ( lower-upper ) *w );
+    }
 
 }
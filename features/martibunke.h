@@ -31,47 +31,88 @@
 #ifndef _martibunke_h_
 #define _martibunke_h_
 
-#include <Magick++.h>
 #include <vector>
+#include <deque>
 #include <math.h>
+#include "grayimage.h"
+#include "framesink.h"
 
 class MartiBunke {
 public:
 
     /* Constructor */
-    MartiBunke ( Magick::Image * i );
+    MartiBunke ( GrayView v );
+    /* Constructor for streaming the features of an image which is pushed a strip of columns at a time */
+    MartiBunke ( int rows, int w, int s, FrameSink * sink );
     /* Destructor */
     ~MartiBunke ();
 
-    /* Calculates the features */
+    /* Calculates the features with a window one column wide */
     std::vector<double> getMartiBunke();
+    /* Calculates the features with a window of w columns, shifted by s columns for each frame */
+    std::vector<double> getMartiBunke ( int w, int s );
+    /* Shares a transposed copy of the image */
+    void setTransposed ( GrayView t );
+    /* Shares the runs of foreground in each column */
+    void setRuns ( const ColumnRuns * r );
+
+    /* Pushes the next strip of columns of a streamed image. Throws if it is not as high as the image */
+    void push ( GrayView strip );
+
+    /* The number of features for each window */
+    static const int FEATURES = 9;
 
 private:
 
-    Magick::Image * image;
-    Magick::Image * column;
-
-    /* Private methods for calculating features */
-    double getF1();
-    double getF2();
-    double getF3();
-    double getF4();
-    double getF5();
-    double getF6(int f4f, int c);
-    double getF7(int f5f, int c);
-    double getF8();
-    double getF9(int f4f, int f5f);
-
-    /* Variables to store features */
-    double f1;
-    double f2;
-    double f3;
-    double f4;
-    double f5;
-    double f6;
-    double f7;
-    double f8;
-    double f9;
+    GrayView image;
+    /* The image with rows and columns swapped, if it has been shared */
+    GrayView transposed;
+    bool shared;
+    /* The runs of foreground in each column, if they have been shared */
+    const ColumnRuns * runs;
+
+    /* Sets up the window and where its frames go */
+    void start ( int rows, int w, int s, FrameSink * sink );
+    /* Takes the next column of the image, as pixels or from the runs */
+    void putColumn ( const float * column );
+    void putColumn();
+    /* Adds column c to the window, or makes a frame with it */
+    void takeColumn ( int c );
+
+    /* The size and shift of the window, and where the frames go */
+    int height;
+    int width;
+    int shift;
+    FrameSink * frames;
+
+    /* The last width+1 columns, which are all that is needed to slide the window and take the gradients. A binary
+     * image is read from its runs instead, which need no ring
+     */
+    std::vector<float> ring;
+    bool binary;
+    /* The number of columns taken so far, and the number of the next frame */
+    int received;
+    long frame;
+
+    /* The state of the window, which is updated as columns enter and leave it */
+    std::vector<double> sums;                       // The sum of each row over the columns in the window
+    std::deque< std::pair<int,int> > uppers;        // Candidates for the highest upper contour, with their columns
+    std::deque< std::pair<int,int> > lowers;        // Candidates for the lowest lower contour, with their columns
+    int transitions;                                // The total number of transitions in the columns in the window
+    double ink;                                     // The number of foreground pixels in the window, for runs
+    double inkRows;                                 // The sum of their rows, for runs
+    double inkSquares;                              // The sum of the squares of their rows, for runs
+
+    /* Clears the window */
+    void resetWindow();
+    /* Adds column c to the right of the window */
+    void addColumn ( int c );
+    /* Removes column c from the left of the window */
+    void removeColumn ( int c );
+    /* Calculates the features of the window starting at column x, with column c to the right of it */
+    void getFrame ( int x, int c, double * features );
+    /* Adds the foreground pixels of the runs of column c to the totals, or takes them away */
+    void sumColumn ( int c, int sign );
 
 };
 
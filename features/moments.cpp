@@ -29,135 +29,437 @@
  */
 
 #include "moments.h"
+#include <algorithm>
 
-/* Constructor */
-Moments::Moments ( Magick::Image * i ) {
-    image = new Magick::Image();
-    image = i;
+/* The size of the tiles, defined here since std::min takes it by reference */
+const int MomentTable::TILE;
+
+/* Binomial coefficients for up to order 3 */
+static const double binomial[4][4] = { { 1, 0, 0, 0 }, { 1, 1, 0, 0 }, { 1, 2, 1, 0 }, { 1, 3, 3, 1 } };
+
+/* Constructor
+ * Builds the summed area tables of every tile in a single pass over the image
+ */
+MomentTable::MomentTable ( GrayView v ) {
+
+    image = v;
+    int width = image.columns();
+    int height = image.rows();
+    tilesAcross = ( width+TILE-1 ) /TILE;
+    int tilesDown = ( height+TILE-1 ) /TILE;
+
+    /* Lay out the tables of the tiles */
+    offsets.resize ( ( size_t ) tilesAcross*tilesDown );
+    size_t size = 0;
+    for ( int b = 0; b < tilesDown; b++ ) {
+        int th = std::min ( TILE, height-b*TILE );
+        for ( int a = 0; a < tilesAcross; a++ ) {
+            int tw = std::min ( TILE, width-a*TILE );
+            offsets[( size_t ) b*tilesAcross+a] = size;
+            size += ( size_t ) ( tw+1 ) * ( th+1 ) *10;
+        }
+    }
+    table.assign ( size, 0.0 );
+
+    /* Powers of x within a tile */
+    double xp[TILE][4];
+    for ( int i = 0; i < TILE; i++ ) {
+        xp[i][0] = 1;
+        xp[i][1] = i;
+        xp[i][2] = ( double ) i*i;
+        xp[i][3] = ( double ) i*i*i;
+    }
+
+    for ( int j = 0; j < height; j++ ) {
+
+        const float * row = image.row ( j );
+        int b = j/TILE;
+        int ly = j-b*TILE;
+        double y = ly;
+        double yq[4] = { 1, y, y*y, y*y*y };
+
+        for ( int a = 0; a < tilesAcross; a++ ) {
+
+            int tw = std::min ( TILE, width-a*TILE );
+            size_t stride = ( size_t ) ( tw+1 ) *10;
+            double * tile = &table[offsets[( size_t ) b*tilesAcross+a]];
+            const double * above = tile + ( size_t ) ly*stride;
+            double * current = tile + ( size_t ) ( ly+1 ) *stride;
+            const float * pixels = row + a*TILE;
+
+            /* Running sums along the row of the tile */
+            double r[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+            for ( int i = 0; i < tw; i++ ) {
+
+                double v = pixels[i];
+                const double * x = xp[i];
+
+                /* The sums are stored in the order m00 m01 m02 m03 m10 m11 m12 m20 m21 m30 */
+                int k = 0;
+                for ( int p = 0; p < 4; p++ ) {
+                    double xv = x[p]*v;
+                    for ( int q = 0; q+p < 4; q++ ) {
+                        r[k] += xv*yq[q];
+                        k++;
+                    }
+                }
+
+                for ( k = 0; k < 10; k++ ) {
+                    current[( i+1 ) *10+k] = above[( i+1 ) *10+k] + r[k];
+                }
+
+            }
+        }
+    }
 
 }
 
 /* Destructor */
-Moments::~Moments() {
+MomentTable::~MomentTable() {
 
 }
 
-/* Gets the center of mass about the x-axis */
-double Moments::getXBar() {
+/* Gets the raw moments of a rectangle from the tables. The part of the rectangle in each tile it covers is looked
+ * up in the tables of that tile, and its moments are moved from the corner of the tile to the corner of the
+ * rectangle by expanding (i+dx)^p (j+dy)^q. The shifts are less than a tile, so little is lost in the expansion.
+ *
+ * @x the column of the top left corner of the rectangle
+ * @y the row of the top left corner of the rectangle
+ * @w the width of the rectangle
+ * @h the height of the rectangle
+ * @m the raw moments m[p][q], p+q <= 3, about the top left corner of the rectangle
+ */
+void MomentTable::getRM ( int x, int y, int w, int h, double m[4][4] ) const {
+
+    for ( int p = 0; p < 4; p++ ) {
+        for ( int q = 0; q < 4; q++ ) {
+            m[p][q] = 0;
+        }
+    }
+    if ( w <= 0 || h <= 0 ) {
+        return;
+    }
+
+    int width = image.columns();
+    int height = image.rows();
+
+    for ( int b = y/TILE; b <= ( y+h-1 ) /TILE; b++ ) {
+
+        int th = std::min ( TILE, height-b*TILE );
+        int y0 = std::max ( y-b*TILE, 0 );
+        int y1 = std::min ( y+h-b*TILE, th );
+        double dy = b*TILE-y;
+        double dyq[4] = { 1, dy, dy*dy, dy*dy*dy };
+
+        for ( int a = x/TILE; a <= ( x+w-1 ) /TILE; a++ ) {
+
+            int tw = std::min ( TILE, width-a*TILE );
+            int x0 = std::max ( x-a*TILE, 0 );
+            int x1 = std::min ( x+w-a*TILE, tw );
+            double dx = a*TILE-x;
+            double dxp[4] = { 1, dx, dx*dx, dx*dx*dx };
+
+            size_t stride = ( size_t ) ( tw+1 ) *10;
+            const double * tile = &table[offsets[( size_t ) b*tilesAcross+a]];
+            const double * c00 = tile + ( size_t ) y0*stride + ( size_t ) x0*10;
+            const double * c01 = tile + ( size_t ) y0*stride + ( size_t ) x1*10;
+            const double * c10 = tile + ( size_t ) y1*stride + ( size_t ) x0*10;
+            const double * c11 = tile + ( size_t ) y1*stride + ( size_t ) x1*10;
+
+            /* The moments of the part about the corner of the tile */
+            double g[4][4] = { { 0 } };
+            int k = 0;
+            for ( int p = 0; p < 4; p++ ) {
+                for ( int q = 0; q+p < 4; q++ ) {
+                    g[p][q] = c11[k] - c01[k] - c10[k] + c00[k];
+                    k++;
+                }
+            }
+
+            /* Moved to the corner of the rectangle */
+            for ( int p = 0; p < 4; p++ ) {
+                for ( int q = 0; q+p < 4; q++ ) {
+                    for ( int i = 0; i <= p; i++ ) {
+                        for ( int j = 0; j <= q; j++ ) {
+                            m[p][q] += binomial[p][i] *binomial[q][j] *dxp[p-i] *dyq[q-j] *g[i][j];
+                        }
+                    }
+                }
+            }
+
+        }
+    }
 
-    /* Calculate the intermediate moments */
+}
+
+/* Constructor
+ * All of the raw moments are calculated here in a single pass over the image
+ */
+Moments::Moments ( GrayView v ) {
+    image = v;
+    normalised = false;
     calculateIntermediaries();
+}
 
-    /* If there are only white pixels the division by zero will be undefined, so instead set it to 0 */
-    if ( m00 == 0.0 ) {
-        x_c = 0;
-        y_c = 0;
+/* Constructor
+ * Looks up the raw moments of a cell in the summed area tables, about the corner of the cell, so that the features
+ * are the same as for a Moments object made from a view of the cell.
+ *
+ * @t the summed area tables of the whole image
+ * @x the column of the top left corner of the cell
+ * @y the row of the top left corner of the cell
+ * @w the width of the cell
+ * @h the height of the cell
+ */
+Moments::Moments ( const MomentTable & t, int x, int y, int w, int h ) {
+
+    /* Clip the cell to the image */
+    image = t.getImage().region ( x, y, w, h );
+    normalised = false;
+    if ( x < 0 ) {
+        x = 0;
     }
-    /* Otherwise calculate x-bar and y-bar */
-    else {
-        x_c = m10/m00;
-        y_c = m01/m00;
+    if ( y < 0 ) {
+        y = 0;
     }
 
-    /* Return x-bar */
+    /* Cells which lie outside of the image are empty */
+    t.getRM ( x, y, image.columns(), image.rows(), m );
+
+    calculateCentre();
+
+}
+
+/* Destructor */
+Moments::~Moments() {
+
+}
+
+/* Gets the center of mass about the x-axis */
+double Moments::getXBar() {
     return x_c;
 }
 
 /* Gets the center of mass about the y-axis */
 double Moments::getYBar() {
+    return y_c;
+}
 
-    /* Calculate the intermediate moments */
-    calculateIntermediaries();
+/* Gets the (p+q)th raw moment.
+ * @p - p-th order
+ * @q - q-th order
+ */
+double Moments::getRM ( int p, int q ) {
 
-    /* If there are only white pixels the division by zero will be undefined, so instead set it to 0 */
-    if ( m00 == 0.0 ) {
-        x_c = 0;
-        y_c = 0;
+    /* Moments up to order 3 were accumulated when the object was created */
+    if ( p >= 0 && q >= 0 && p+q <= 3 ) {
+        return m[p][q];
     }
-    /* Otherwise calculate x-bar and y-bar */
-    else {
-        x_c = m10/m00;
-        y_c = m01/m00;
+
+    /* Higher orders need another pass over the image */
+    double rmom = 0;
+    for ( int j = 0; j < image.rows(); j++ ) {
+        const float * row = image.row ( j );
+        for ( int i = 0; i < image.columns(); i++ ) {
+            rmom += pow ( i,p ) *pow ( j,q ) *row[i];
+        }
     }
+    return rmom;
 
-    /* Return y-bar */
-    return y_c;
 }
 
 /* Calculates the (p+q)th centralised moment normalised with respect to the center of mass.
+ * For p+q <= 3 it is given in closed form by the binomial expansion of (x-x_c)^p (y-y_c)^q over the raw moments.
  * @p - p-th order
  * @q - q-th order
  */
 
 double Moments::getCM ( int p, int q ) {
 
-    /* Calculate the intermediate moments */
-    calculateIntermediaries();
+    double cmom = 0;
 
-    /* If there are only white pixels the division by zero will be undefined, so instead set it to 0 */
-    if ( m00 == 0.0 ) {
-        x_c = 0;
-        y_c = 0;
-    }
-    /* Otherwise calculate x-bar and y-bar */
-    else {
-        x_c = m10/m00;
-        y_c = m01/m00;
-    }
-
-    /* Calculate the (p+q)th central moment */
-    for ( unsigned int i = 0; i < image->columns(); i++ ) {
-        for ( unsigned int j = 0; j < image->rows(); j++ ) {
-            cmom += pow ( ( i-x_c ),p ) *pow ( ( j-y_c ),q ) *Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
+    if ( p+q <= 3 ) {
+        for ( int i = 0; i <= p; i++ ) {
+            for ( int j = 0; j <= q; j++ ) {
+                cmom += binomial[p][i] *binomial[q][j] *pow ( -x_c, p-i ) *pow ( -y_c, q-j ) *m[i][j];
+            }
+        }
+    } else {
+        /* Calculate the (p+q)th central moment directly */
+        for ( int j = 0; j < image.rows(); j++ ) {
+            const float * row = image.row ( j );
+            for ( int i = 0; i < image.columns(); i++ ) {
+                cmom += pow ( ( i-x_c ),p ) *pow ( ( j-y_c ),q ) *row[i];
+            }
         }
     }
 
-    /* Return the central momeny */
+    /* Return the central moment */
     return cmom;
 
 }
 
 /* Calculates the (p+q)th normalised central moment.
+ * For p+q <= 3 they are all calculated the first time one is asked for, and then looked up.
  * @p - p-th order
  * @q - q-th order
  */
 
 double Moments::getNCM ( int p, int q ) {
 
-    /* Initialise the normalised central moment */
-
-    ncmom = 0;
+    if ( p >= 0 && q >= 0 && p+q <= 3 ) {
+        if ( !normalised ) {
+            calculateNormalised();
+        }
+        return ncm[p][q];
+    }
 
     /* Calculate gamma y */
     double y = ( ( p+q ) /2 ) + 1;
 
     /* Get centralised moment 0,0 and set to 1 if necessary to prevent division by zero */
-    double b = getCM ( 0,0 );
+    double b = m[0][0];
     if ( b == 0.0 ) {
         b = 1.0;
     }
 
     /* Calculate the normalised central moment and return it */
-    ncmom = getCM ( p,q ) / ( pow ( b,y ) );
-    return ncmom;
+    return getCM ( p,q ) / ( pow ( b,y ) );
+
+}
+
+/* Calculates the n-th Hu invariant moment from the normalised central moments, which are worked out once for each
+ * object however many of the invariants are asked for.
+ * @n - which of the first four invariants to return
+ */
+double Moments::getHu ( int n ) {
+
+    if ( !normalised ) {
+        calculateNormalised();
+    }
+
+    double ncm20 = ncm[2][0];
+    double ncm02 = ncm[0][2];
+    double ncm11 = ncm[1][1];
+    double ncm30 = ncm[3][0];
+    double ncm12 = ncm[1][2];
+    double ncm21 = ncm[2][1];
+    double ncm03 = ncm[0][3];
+
+    double a;
+    double b;
+    switch ( n ) {
+    case 1:
+        return ncm20 + ncm02;
+    case 2:
+        a = ncm20-ncm02;
+        return a*a + 4*ncm11*ncm11;
+    case 3:
+        a = ncm30-3*ncm12;
+        b = 3*ncm21-ncm03;
+        return a*a + b*b;
+    case 4:
+        a = ncm30+ncm12;
+        b = ncm21-ncm03;
+        return a*a + b*b;
+    }
+
+    return 0;
 
 }
 
-/* Calculates the intermediate values which are used in the calculation of moments */
+/* Calculates the raw moments up to order 3 in a single pass over the image, as well as the center of mass */
 void Moments::calculateIntermediaries() {
 
-    /* Initialise the intermediate moments */
-    cmom = 0;
-    m00 = 0;
-    m10 = 0;
-    m01 = 0;
-
-    /* Calculate intermidiate moments */
-    for ( unsigned int i = 0; i < image->columns(); i++ ) {
-        for ( unsigned int j = 0; j < image->rows(); j++ ) {
-            m00 += Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
-            m10 += i*Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
-            m01 += j*Magick::ColorGray ( image->pixelColor ( i,j ) ).shade();
+    /* Initialise the raw moments */
+    for ( int p = 0; p < 4; p++ ) {
+        for ( int q = 0; q < 4; q++ ) {
+            m[p][q] = 0;
         }
     }
+
+    /* Each row is summed against powers of x first, and the row sums are then weighted by powers of y */
+    for ( int j = 0; j < image.rows(); j++ ) {
+        const float * row = image.row ( j );
+        double s0 = 0;
+        double s1 = 0;
+        double s2 = 0;
+        double s3 = 0;
+        for ( int i = 0; i < image.columns(); i++ ) {
+            double v = row[i];
+            double x = i;
+            s0 += v;
+            s1 += x*v;
+            s2 += x*x*v;
+            s3 += x*x*x*v;
+        }
+        double y = j;
+        m[0][0] += s0;
+        m[0][1] += y*s0;
+        m[0][2] += y*y*s0;
+        m[0][3] += y*y*y*s0;
+        m[1][0] += s1;
+        m[1][1] += y*s1;
+        m[1][2] += y*y*s1;
+        m[2][0] += s2;
+        m[2][1] += y*s2;
+        m[3][0] += s3;
+    }
+
+    calculateCentre();
+
+}
+
+/* Calculates the normalised central moments up to order 3 from the raw moments, with the powers of the centre and
+ * of m00 built up by multiplication rather than with pow
+ */
+void Moments::calculateNormalised() {
+
+    /* Set m00 to 1 if necessary to prevent division by zero */
+    double b = m[0][0];
+    if ( b == 0.0 ) {
+        b = 1.0;
+    }
+
+    /* Gamma is (p+q)/2+1, so the first two orders are divided by m00 and the next two by its square */
+    double scale[4] = { b, b, b*b, b*b };
+    double dx[4];
+    double dy[4];
+    dx[0] = 1;
+    dy[0] = 1;
+    for ( int k = 1; k < 4; k++ ) {
+        dx[k] = dx[k-1]*-x_c;
+        dy[k] = dy[k-1]*-y_c;
+    }
+
+    for ( int p = 0; p < 4; p++ ) {
+        for ( int q = 0; p+q < 4; q++ ) {
+            double cmom = 0;
+            for ( int i = 0; i <= p; i++ ) {
+                for ( int j = 0; j <= q; j++ ) {
+                    cmom += binomial[p][i] *binomial[q][j] *dx[p-i] *dy[q-j] *m[i][j];
+                }
+            }
+            ncm[p][q] = cmom/scale[p+q];
+        }
+    }
+    normalised = true;
+
+}
+
+/* Calculates the center of mass from the raw moments */
+void Moments::calculateCentre() {
+
+    /* If there are only white pixels the division by zero will be undefined, so instead set it to 0 */
+    if ( m[0][0] == 0.0 ) {
+        x_c = 0;
+        y_c = 0;
+    }
+    /* Otherwise calculate x-bar and y-bar */
+    else {
+        x_c = m[1][0]/m[0][0];
+        y_c = m[0][1]/m[0][0];
+    }
+
 }
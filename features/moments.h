@@ -22,23 +22,71 @@
  * International Conference on,  Los Alamitos, CA, USA: IEEE Computer Society, 2003, p. 664.
  */
 
-/* This program calculates the statistical moments to be used as features. The Feature class calculates the Hu
- * features based on the moments produced by this class
+/* This program calculates the statistical moments to be used as features. All raw moments up to order 3 are
+ * accumulated in a single pass over the image, or looked up in a MomentTable, and the central and normalised
+ * moments, the center of gravity and the Hu invariants used by the Feature class are derived from them in closed form.
  */
 
 #ifndef _moments_h_
 #define _moments_h_
 
-#include <Magick++.h>
 #include <math.h>
+#include <vector>
+#include "grayimage.h"
+
+/* Summed area tables of x^p * y^q * I(x,y) for p+q <= 3. Built with one pass over the image, after which the raw
+ * moments of any rectangle are given by four lookups in each tile it covers, so overlapping cells cost no more than
+ * disjoint ones.
+ *
+ * The image is split into tiles of TILE x TILE pixels, and each tile has its own tables with x and y measured from
+ * the corner of the tile. Sums from the corner of a whole page would reach 1e18 for the third order moments, past
+ * what a double holds exactly, and the moments of a small cell would be lost when the sums are subtracted.
+ */
+class MomentTable {
+public:
+
+    /* Constructor */
+    MomentTable ( GrayView v );
+    ~MomentTable ();
+
+    /* Gets the raw moments m[p][q] of the rectangle at (x,y) with size w*h, with x and y measured from the corner of
+     * the rectangle. The rectangle must lie inside the image
+     */
+    void getRM ( int x, int y, int w, int h, double m[4][4] ) const;
+
+    /* The size of the tiles */
+    static const int TILE = 32;
+    /* Gets the image that the table was built from */
+    GrayView getImage() const {
+        return image;
+    }
+
+private:
+
+    GrayView image;
+    /* The tables of each tile, one after the other a row of tiles at a time. A tile w*h pixels has (w+1)*(h+1)
+     * corners, and the ten sums for each corner are stored next to each other
+     */
+    std::vector<double> table;
+    /* The number of tiles across the image, and where the tables of each tile start */
+    int tilesAcross;
+    std::vector<size_t> offsets;
+
+};
 
 class Moments {
 public:
 
-    /* Constructor */
-    Moments ( Magick::Image * i );
+    /* Constructors */
+    Moments ( GrayView v );
+    /* Gets the moments of the cell at (x,y) with size w*h from the table. The cell is clipped like
+     * Magick::Image::crop
+     */
+    Moments ( const MomentTable & t, int x, int y, int w, int h );
     ~Moments ();
 
+    /* Gets the raw moment pq */
+    double getRM ( int p, int q );
     /*Gets the central moment pq */
     double getCM ( int p, int q );
     /* Gets the normalised central moment pq */
@@ -46,22 +94,26 @@ public:
     /* Gets the center of gravity about each axis */
     double getXBar();
     double getYBar();
+    /* Gets the n-th (1 to 4) Hu invariant moment */
+    double getHu ( int n );
 
 private:
 
-    Magick::Image * image;
+    GrayView image;
 
     /* Needed to calculate intermediate values */
     void calculateIntermediaries();
+    void calculateCentre();
+    void calculateNormalised();
 
+    /* Raw moments m[p][q] for p+q <= 3 */
+    double m[4][4];
     /* Variables used in feature calculation */
-    double m00;
-    double m10;
-    double m01;
     double x_c;
     double y_c;
-    double cmom;
-    double ncmom;
+    /* Normalised central moments ncm[p][q] for p+q <= 3, which are only calculated when they are first needed */
+    double ncm[4][4];
+    bool normalised;
 
 };
 
@@ -0,0 +1,91 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Checks that the moments looked up in a MomentTable match those of a single pass over a view of the cell, for small
+ * cells in the far corner of a strip as wide as a page, where sums from the corner of the strip would lose them. The
+ * third order sums of the strip reach 1e16, past what a double holds exactly.
+ *
+ * Build and run from the features directory with:
+ *     g++ -O2 -iquote . tests/momentstest.cpp moments.cpp grayimage.cpp `Magick++-config --cppflags --libs` -o momentstest
+ *     ./momentstest
+ */
+
+#include "moments.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Whether two values agree to within a relative tolerance, or both are close to zero */
+static bool agree ( double a, double b ) {
+    double scale = fabs ( a ) > fabs ( b ) ? fabs ( a ) : fabs ( b );
+    return fabs ( a-b ) <= 1e-9*scale + 1e-12;
+}
+
+int main() {
+
+    /* A strip of noisy greyscale pixels as wide as a page. The tables take about 100 MB */
+    int width = 3000;
+    int height = 400;
+    std::vector<float> pixels ( ( size_t ) width*height );
+    srand ( 1 );
+    for ( size_t i = 0; i < pixels.size(); i++ ) {
+        pixels[i] = ( rand() %256 ) /255.0f;
+    }
+    GrayView page ( &pixels[0], width, height, width );
+    MomentTable table ( page );
+
+    /* Cells of a few sizes near the bottom right corner, some of them across tile edges and some clipped */
+    int failures = 0;
+    const int sizes[][2] = { { 3, 3 }, { 5, 7 }, { 8, 8 }, { 16, 12 }, { 40, 33 }, { 70, 90 } };
+    for ( int s = 0; s < 6; s++ ) {
+        for ( int k = 0; k < 20; k++ ) {
+
+            int w = sizes[s][0];
+            int h = sizes[s][1];
+            int x = width-w-rand() %100 + ( k == 0 ? w/2 : 0 );
+            int y = height-h-rand() %100 + ( k == 0 ? h/2 : 0 );
+
+            Moments looked ( table, x, y, w, h );
+            Moments direct ( page.region ( x, y, w, h ) );
+
+            bool same = agree ( looked.getXBar(), direct.getXBar() ) && agree ( looked.getYBar(), direct.getYBar() );
+            for ( int p = 0; p < 4; p++ ) {
+                for ( int q = 0; p+q < 4; q++ ) {
+                    same = same && agree ( looked.getRM ( p, q ), direct.getRM ( p, q ) );
+                    same = same && agree ( looked.getCM ( p, q ), direct.getCM ( p, q ) );
+                }
+            }
+            for ( int n = 1; n <= 4; n++ ) {
+                same = same && agree ( looked.getHu ( n ), direct.getHu ( n ) );
+            }
+
+            if ( !same ) {
+                printf ( "FAIL cell %dx%d at (%d,%d): mu30 %.17g against %.17g, hu3 %.17g against %.17g\n", w, h, x, y,
+                         looked.getCM ( 3, 0 ), direct.getCM ( 3, 0 ), looked.getHu ( 3 ), direct.getHu ( 3 ) );
+                failures++;
+            }
+
+        }
+    }
+
+    if ( failures == 0 ) {
+        printf ( "PASS\n" );
+    }
+    return failures == 0 ? 0 : 1;
+
+}
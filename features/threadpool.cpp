@@ -0,0 +1,270 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Implements the ThreadPool class */
+
+#include "threadpool.h"
+#include <algorithm>
+
+/* The index of the worker running on this thread, and the pool it belongs to */
+static thread_local int workerIndex = -1;
+static thread_local ThreadPool * workerPool = 0;
+
+/* Constructor
+ *
+ * @threads the number of worker threads, or 0 to use one for each processor
+ */
+ThreadPool::ThreadPool ( int threads ) {
+
+    if ( threads <= 0 ) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if ( threads <= 0 ) {
+        threads = 1;
+    }
+
+    queued = 0;
+    pending = 0;
+    stopping = false;
+    next = 0;
+
+    for ( int i = 0; i < threads; i++ ) {
+        queues.push_back ( std::unique_ptr<Queue> ( new Queue() ) );
+    }
+    for ( int i = 0; i < threads; i++ ) {
+        workers.push_back ( std::thread ( &ThreadPool::run, this, i ) );
+    }
+
+}
+
+/* Destructor */
+ThreadPool::~ThreadPool() {
+
+    wait();
+    {
+        std::lock_guard<std::mutex> lock ( mutex );
+        stopping = true;
+    }
+    wake.notify_all();
+    for ( unsigned int i = 0; i < workers.size(); i++ ) {
+        workers[i].join();
+    }
+
+}
+
+/* The number of worker threads */
+int ThreadPool::size() const {
+    return workers.size();
+}
+
+/* The index of the worker that the calling thread is */
+int ThreadPool::getWorker() {
+    return workerIndex;
+}
+
+/* Adds a task. A worker of this pool adds it to its own queue, and other threads share tasks out in turn
+ *
+ * @task the task to run
+ */
+void ThreadPool::submit ( std::function<void()> task ) {
+
+    pending++;
+
+    int index;
+    if ( workerPool == this ) {
+        index = workerIndex;
+    } else {
+        std::lock_guard<std::mutex> lock ( mutex );
+        index = next++ % queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock ( queues[index]->mutex );
+        queues[index]->tasks.push_back ( task );
+    }
+    {
+        std::lock_guard<std::mutex> lock ( mutex );
+        queued++;
+    }
+    wake.notify_one();
+
+}
+
+/* Takes a task. The newest task in the worker's own queue is taken first, and then the oldest task of each other
+ * queue in turn
+ *
+ * @index the queue to look in first
+ * @task set to the task
+ */
+bool ThreadPool::take ( int index, std::function<void()> & task ) {
+
+    int n = queues.size();
+    for ( int i = 0; i < n; i++ ) {
+        Queue & q = *queues[( index+i ) %n];
+        std::unique_lock<std::mutex> lock ( q.mutex );
+        if ( q.tasks.empty() ) {
+            continue;
+        }
+        if ( i == 0 ) {
+            task = std::move ( q.tasks.back() );
+            q.tasks.pop_back();
+        } else {
+            task = std::move ( q.tasks.front() );
+            q.tasks.pop_front();
+        }
+        lock.unlock();
+
+        std::lock_guard<std::mutex> count ( mutex );
+        queued--;
+        return true;
+    }
+    return false;
+
+}
+
+/* Runs a task and wakes anyone waiting once the last task is done. A task which throws is still counted as done, and
+ * its exception is dropped rather than ending the program, so tasks which need to report failures must catch them
+ */
+void ThreadPool::execute ( std::function<void()> & task ) {
+    try {
+        task();
+    } catch ( ... ) {
+    }
+    task = nullptr;
+    if ( --pending == 0 ) {
+        std::lock_guard<std::mutex> lock ( mutex );
+        done.notify_all();
+    }
+}
+
+/* The loop that each worker runs, sleeping when there is nothing to take
+ *
+ * @index the index of the worker
+ */
+void ThreadPool::run ( int index ) {
+
+    workerIndex = index;
+    workerPool = this;
+
+    std::function<void()> task;
+    while ( true ) {
+        if ( take ( index, task ) ) {
+            execute ( task );
+            continue;
+        }
+        std::unique_lock<std::mutex> lock ( mutex );
+        wake.wait ( lock, [this] () {
+            return stopping || queued > 0;
+        } );
+        if ( stopping && queued == 0 ) {
+            return;
+        }
+    }
+
+}
+
+/* Waits until every submitted task has run */
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock ( mutex );
+    done.wait ( lock, [this] () {
+        return pending == 0;
+    } );
+}
+
+/* Runs a loop on the pool. The range is split into a few pieces for each worker, and body is called with each
+ * piece as [begin, end). The calling thread runs tasks too while it waits, so nested loops cannot deadlock, and
+ * sleeps once there is nothing left to take until the last piece is done.
+ *
+ * If body throws, the other pieces still run and the first exception is thrown again here once they are all done
+ *
+ * @first the first index
+ * @last one past the last index
+ * @body the body of the loop
+ */
+void ThreadPool::parallelFor ( int first, int last, std::function<void(int, int)> body ) {
+
+    int n = last-first;
+    if ( n <= 0 ) {
+        return;
+    }
+
+    int pieces = std::min ( n, 4*size() );
+    std::shared_ptr<Loop> loop ( new Loop() );
+    loop->remaining = pieces;
+    for ( int p = 0; p < pieces; p++ ) {
+        int begin = first + ( int ) ( ( long long ) n*p/pieces );
+        int end = first + ( int ) ( ( long long ) n* ( p+1 ) /pieces );
+        submit ( [body, begin, end, loop] () {
+            std::exception_ptr error;
+            try {
+                body ( begin, end );
+            } catch ( ... ) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock ( loop->mutex );
+            if ( error && !loop->error ) {
+                loop->error = error;
+            }
+            if ( --loop->remaining == 0 ) {
+                loop->done.notify_all();
+            }
+        } );
+    }
+
+    /* Help until there is nothing left to take, then wait for the pieces that other threads are running */
+    int index = workerPool == this ? workerIndex : 0;
+    std::function<void()> task;
+    while ( true ) {
+        {
+            std::lock_guard<std::mutex> lock ( loop->mutex );
+            if ( loop->remaining == 0 ) {
+                break;
+            }
+        }
+        if ( take ( index, task ) ) {
+            execute ( task );
+            continue;
+        }
+        std::unique_lock<std::mutex> lock ( loop->mutex );
+        loop->done.wait ( lock, [&loop] () {
+            return loop->remaining == 0;
+        } );
+    }
+
+    if ( loop->error ) {
+        std::rethrow_exception ( loop->error );
+    }
+
+}
+
+/* Runs a loop on a pool, or runs the whole range at once on the calling thread if there is no pool. This lets the
+ * feature classes use the same loop whether or not they have been given a pool
+ *
+ * @pool the pool, or 0
+ * @first the first index
+ * @last one past the last index
+ * @body the body of the loop
+ */
+void ThreadPool::parallelFor ( ThreadPool * pool, int first, int last, std::function<void(int, int)> body ) {
+    if ( pool != 0 ) {
+        pool->parallelFor ( first, last, body );
+    } else if ( first < last ) {
+        body ( first, last );
+    }
+}
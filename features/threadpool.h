@@ -0,0 +1,110 @@
+/*
+    Learning to Read Bushman - Handwriting Recognition for Bushman Languages
+    Copyright (C) 2010 Kyle Williams <kwilliams@cs.uct.ac.za>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* A pool of worker threads with work stealing.
+ *
+ * Each worker has its own queue of tasks. A worker takes the newest task from its own queue, and when that is empty
+ * it steals the oldest task from another worker's queue, so busy workers keep their recent work in cache while idle
+ * workers take the larger, older pieces. Tasks submitted from outside the pool are shared out between the queues in
+ * turn, and tasks submitted by a worker go on its own queue.
+ *
+ * parallelFor splits a loop into ranges that run on the pool. The calling thread helps to run tasks until its loop
+ * is done, so it can be used from inside a task without deadlocking the pool. An exception thrown by the body is
+ * passed back to the calling thread.
+ */
+
+#ifndef _threadpool_h_
+#define _threadpool_h_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+
+class ThreadPool {
+public:
+
+    /* Constructor */
+    ThreadPool ( int threads );
+    /* Destructor. Waits for the tasks which have been submitted */
+    ~ThreadPool ();
+
+    /* Adds a task to the pool. Anything the task throws is dropped */
+    void submit ( std::function<void()> task );
+    /* Waits until every submitted task has run. Must not be called from a task */
+    void wait ();
+    /* Runs body(i) for every i in [first, last) on the pool, returning once they have all run */
+    void parallelFor ( int first, int last, std::function<void(int, int)> body );
+    /* Runs the loop on the pool if there is one, or else runs it all on the calling thread */
+    static void parallelFor ( ThreadPool * pool, int first, int last, std::function<void(int, int)> body );
+
+    /* The number of worker threads */
+    int size() const;
+    /* The index of the worker that the calling thread is, or -1 if it is not a worker of any pool */
+    static int getWorker();
+
+private:
+
+    /* Not copyable */
+    ThreadPool ( const ThreadPool & );
+    ThreadPool & operator= ( const ThreadPool & );
+
+    /* The tasks waiting for one worker */
+    struct Queue {
+        std::deque< std::function<void()> > tasks;
+        std::mutex mutex;
+    };
+
+    std::vector< std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+
+    /* Guards sleeping and waking. queued is the number of tasks in the queues and pending the number not yet done */
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    long queued;
+    std::atomic<long> pending;
+    bool stopping;
+    unsigned int next;
+
+    /* The state of one parallelFor, shared by its pieces. remaining is the number of pieces not yet done, and error
+     * the first exception that a piece threw
+     */
+    struct Loop {
+        int remaining;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    /* The loop that each worker runs */
+    void run ( int index );
+    /* Takes a task, first from the given queue and then from the others. Returns false if there are none */
+    bool take ( int index, std::function<void()> & task );
+    /* Runs a task and marks it done */
+    void execute ( std::function<void()> & task );
+
+};
+
+#endif // _threadpool_h_
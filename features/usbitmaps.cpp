@@ -27,12 +27,14 @@
 
 #include "usbitmaps.h"
 #include <iostream>
+#include <algorithm>
 /* Constructor
- * Create a copy of the image so as not to modify the original.
+ * Keeps a view of the greyscale image. The pixels are only read from, so nothing is copied
  */
-USBitmaps::USBitmaps ( Magick::Image * i ) {
-    image = new Magick::Image();
-    image = i;
+USBitmaps::USBitmaps ( GrayView v ) {
+    image = v;
+    thresholded = 0;
+    scanned = 0;
 }
 
 /* Destructor */
@@ -40,44 +42,103 @@ USBitmaps::~USBitmaps() {
 
 }
 
+/* Shares a thresholded copy of the image, which the regions are then counted from
+ *
+ * @b the thresholded image, which must be the same size as the view and outlive this object, or 0
+ */
+void USBitmaps::setBinary ( const BinaryImage * b ) {
+    thresholded = b;
+}
+
+/* Thresholds the image, unless a thresholded copy has been shared. Pixels of at least 0.5 are foreground */
+void USBitmaps::buildBinary() {
+    if ( thresholded == 0 ) {
+        binary = BinaryImage ( image );
+        thresholded = &binary;
+    }
+}
+
+/* Builds the summed area table from the thresholded image */
+void USBitmaps::buildTable() {
+
+    int columns = image.columns();
+    int rows = image.rows();
+    int stride = columns+1;
+    table.assign ( ( size_t ) ( rows+1 ) *stride, 0 );
+
+    for ( int y = 0; y < rows; y++ ) {
+        const uint64_t * row = thresholded->row ( y );
+        const unsigned int * above = &table[( size_t ) y*stride];
+        unsigned int * current = &table[( size_t ) ( y+1 ) *stride];
+        unsigned int sum = 0;
+        for ( int k = 0; k < thresholded->words(); k++ ) {
+            uint64_t word = row[k];
+            int end = std::min ( columns, ( k+1 ) *64 );
+            for ( int x = k*64; x < end; x++ ) {
+                sum += word & 1;
+                word >>= 1;
+                current[x+1] = above[x+1] + sum;
+            }
+        }
+    }
+
+}
+
 /* Calculates the features
- * @r the number of regions to divide the image into
+ * The image is divided into h rows and w columns of regions. Region k along a side of length n runs from
+ * floor(k*n/w) up to floor((k+1)*n/w), so the regions always cover the whole image even when the size is not
+ * divisible by the number of regions. The regions are given a column at a time, top to bottom, and the counts are
+ * divided by the largest count.
+ *
+ * @h the number of regions down the image
+ * @w the number of regions across the image
  */
 std::vector<double> USBitmaps::getUSBitmaps ( int h, int w ) {
 
     std::vector<double> features;
+    if ( h < 1 || w < 1 ) {
+        return features;
+    }
+
+    buildBinary();
+    features.reserve ( ( size_t ) h*w );
 
-    int pcount = 0;
+    int columns = image.columns();
+    int rows = image.rows();
     double pmax = 0;
-    /*Loop through the image, going through one region at a time */
-    for ( unsigned int i = image->columns() /w; i <= image->columns(); i+= (image->columns()/w >= 1 ? image->columns()/w : 1)) {
 
-        for ( unsigned int j = image->rows() /h; j <= image->rows(); j+=image->rows() /h ) {
+    /* Counting a grid reads every word of every row, and a few more for the edges of the regions. The table is only
+     * built once the grids counted so far have cost about as much as building it, so the counting never costs more
+     * than twice what it would have with the better of the two
+     */
+    if ( table.empty() ) {
+        scanned += ( long long ) rows* ( thresholded->words() + w );
+        if ( scanned > ( long long ) TABLE_GRIDS*rows*thresholded->words() ) {
+            buildTable();
+        }
+    }
+
+    /*Loop through the image, going through one region at a time */
+    for ( int i = 0; i < w; i++ ) {
+        int x0 = ( int ) ( ( long long ) i*columns/w );
+        int x1 = ( int ) ( ( long long ) ( i+1 ) *columns/w );
+        for ( int j = 0; j < h; j++ ) {
+            int y0 = ( int ) ( ( long long ) j*rows/h );
+            int y1 = ( int ) ( ( long long ) ( j+1 ) *rows/h );
 
-            /*For the current region count the number of foreground pixels */
-            for ( unsigned int k = i- ( image->columns() /w ); k < i; k++ ) {
-                for ( unsigned int l = j- ( image->rows() /h ); l < j; l++ ) {
-                    if ( Magick::ColorGray ( image->pixelColor ( k,l ) ).shade() >= 0.5 ) {
-                        pcount++;
-                    }
-                }
-            }
             /* Add the number of foreground pixels to the feature vector and check for max */
+            double pcount = getCount ( x0, y0, x1, y1 );
             features.push_back ( pcount );
             if ( pcount > pmax ) {
                 pmax = pcount;
             }
-            pcount = 0;
         }
     }
 
     /* Normalise all features by dividing by the max */
-    for ( unsigned int i = 0; i < features.size(); i++ ) {
-        if (pmax > 0){
-          features.at ( i ) = features.at ( i ) /pmax;
-        }
-        else {
-          features.at ( i ) = features.at ( i ) /1;
+    if ( pmax > 0 ) {
+        for ( unsigned int i = 0; i < features.size(); i++ ) {
+            features[i] = features[i] /pmax;
         }
     }
 
@@ -85,3 +146,20 @@ std::vector<double> USBitmaps::getUSBitmaps ( int h, int w ) {
     return features;
 
 }
+
+/* Calculates the features for several grid sizes from the same thresholded image. Each grid is normalised on its own
+ * and the features of the grids are given one after the other.
+ *
+ * @h the number of regions down the image for each grid
+ * @w the number of regions across the image for each grid
+ */
+std::vector<double> USBitmaps::getUSBitmaps ( std::vector<int> h, std::vector<int> w ) {
+
+    std::vector<double> features;
+    for ( unsigned int i = 0; i < h.size() && i < w.size(); i++ ) {
+        std::vector<double> grid = getUSBitmaps ( h[i], w[i] );
+        features.insert ( features.end(), grid.begin(), grid.end() );
+    }
+    return features;
+
+}
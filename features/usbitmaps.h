@@ -23,30 +23,68 @@
 
 /*
  * The undersampled bitmap feature divides an image into regions and then calculated the normalised number of pixels in each region
+ *
+ * The image is thresholded once into a bit-packed BinaryImage, and the foreground pixels of each region are counted
+ * with popcounts a word at a time, so a whole grid costs one pass over the packed rows. When many grids are asked
+ * of the same image, a summed area table is built from the bits instead and each region costs four lookups.
  */
 
 #ifndef _usbitmaps_h_
 #define _usbitmaps_h_
 
-#include <Magick++.h>
 #include <math.h>
 #include <vector>
+#include "grayimage.h"
 
 class USBitmaps {
     public:
 
         /* Constructor */
-        USBitmaps ( Magick::Image * i );
+        USBitmaps ( GrayView v );
         ~USBitmaps ();
 
         /* Calculates the features */
         std::vector<double> getUSBitmaps ( int h, int w );
+        /* Calculates the features for several grid sizes, one after the other */
+        std::vector<double> getUSBitmaps ( std::vector<int> h, std::vector<int> w );
+        /* Shares a thresholded copy of the image */
+        void setBinary ( const BinaryImage * b );
 
     private:
 
-        Magick::Image * image;
+        GrayView image;
+        const BinaryImage * thresholded;
         int regions;
 
+        /* The thresholded image, which is either shared or made here when it is first needed */
+        BinaryImage binary;
+        /* Thresholds the image if no thresholded copy has been shared */
+        void buildBinary();
+        /* The number of foreground pixels above and to the left of each pixel, with a row and column of zeros first.
+         * It is only built once enough grids have been counted to pay for it
+         */
+        std::vector<unsigned int> table;
+        /* The number of grids whose counting costs about as much as building the table, which takes an entry for
+         * every pixel rather than every word. The table is built once this many grids have been counted
+         */
+        static const int TABLE_GRIDS = 200;
+        /* The words that have been counted from the thresholded image so far */
+        long long scanned;
+        /* Builds the table from the thresholded image */
+        void buildTable();
+        /* Gets the number of foreground pixels in the region [x0, x1) x [y0, y1) */
+        unsigned int getCount ( int x0, int y0, int x1, int y1 ) const {
+            if ( !table.empty() ) {
+                int stride = image.columns() +1;
+                return table[( size_t ) y1*stride+x1] - table[( size_t ) y0*stride+x1] - table[( size_t ) y1*stride+x0] + table[( size_t ) y0*stride+x0];
+            }
+            unsigned int n = 0;
+            for ( int y = y0; y < y1; y++ ) {
+                n += BinaryImage::count ( thresholded->row ( y ), x0, x1 );
+            }
+            return n;
+        }
+
 };
 
 #endif // _usbitmaps_h_ 